@@ -18,14 +18,11 @@
  * @P_THRESH:
  */
 ellipse(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, P_THRESH):-
-    ellipse(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, P_THRESH, _, _).
+    ellipse_support(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, _, R),
+    (R >= P_THRESH; true), !.
 ellipse(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, P_THRESH, Pos, PTS):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     ellipse_points([X, Y, F], [A, B, ALPHA], [W, H, D], PTS),
-    pts_scharr(Imgseq, PTS, VARS),
-    write(VARS), nl,
-    items_key_geq_T(PTS, VARS, VAR_THRESH, Pos),
-    length(Pos, N_Pos), length(PTS, Total),
-    R is N_Pos / Total,
-    write(R), nl,
+    ellipse_support(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, _, R,
+                    Pos),
     (R >= P_THRESH; true), !.
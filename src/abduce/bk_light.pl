@@ -53,6 +53,19 @@ ab_light_source(Imgseq, Frame, T, Possible_Dirs, Sources):-
      (Sources1 = Sources, !)),
     ab_light_source(Imgseq, Frame, T1, New_Dirs, Sources1).
 
+% ab_light_sources(+Imgseq, +Frame, -Sources)
+% abduce light sources by native voting: the best directions of sampled
+% points are intersected pairwise (as ray_source_intsct/3) and the
+% intersections vote, Sources is a list of Votes-[X, Y, Frame] in
+% decreasing order of votes
+ab_light_sources(Imgseq, Frame, Sources):-
+    eval_times(N), step_size(Step), best_percentage(T),
+    random(0, 65536, Seed),
+    light_source_votes(Imgseq, Frame,
+                       [points(N), step(Step), best(T), grad(2, -1, 20),
+                        seed(Seed)],
+                       Sources).
+
 %========================================
 % Samplables
 %========================================
@@ -124,42 +137,22 @@ eval_light_source(Imgseq, Frame, Source, Prob, T, Success, Fail):-
 % best_dirs(+Imgseq, +Position, +Step, -Prp_dirs)
 % best directions in position [X, Y, Frame] of Imgseq
 best_dirs(Imgseq, [X, Y, Frame], Step, Prp_dirs):-
-    radial_lines_2d([X, Y, Frame], 0, 359, Step, Rays), % sample radial lines
-    sample_lines_L_grads(Imgseq, Rays, Pts, Gs),
-    % calculate grad+/grad- proportions
-    grad_prop(Pts, Gs, Prps),
-    % make pair: (Proportion-Ray)
-    pairs_keys_values(Prp_ray, Prps, Rays),
-    % sort and get decreasing ordered ray list
-    keysort(Prp_ray, Prp_ray_sorted1),
-    reverse(Prp_ray_sorted1, Prp_ray_sorted),
-    % number of best directions
-    length(Prp_ray_sorted, N), best_percentage(T), M is ceil(N*T),
-    % return best directions
-    (prefix(Prp_dirs, Prp_ray_sorted), length(Prp_dirs, M), !).
+    % number of radial lines in [0, 359] and best directions
+    N is 359 // Step + 1, best_percentage(T), M is ceil(N*T),
+    % (Proportion-Ray) of radial lines in decreasing order, proportion is
+    % grad+ (>= 2) / grad- (< -1), -1 for trivial directions (no more than
+    % 20 brightness changed points)
+    best_radial_dirs(Imgseq, [X, Y, Frame], [0, 359, Step], [2, -1, 20],
+                     M, Prp_dirs).
 
 % point_in_img(+Imgseq, +Frame, ?[X, Y]).
 % sample a point in image (frame in image sequence)
 point_in_img(Imgseq, Frame, [X, Y, Frame]):-
     var(X), var(Y),
-    size_2d(Imgseq, W, H),
+    seq_size(Imgseq, W, H, _),
     random(0, W, X), random(0, H, Y),
     !. % random position
 
-/* proportion of gradients (Pos/Neg) */
-grad_prop([], [], []):-
-    !.
-grad_prop([Pts | Points], [Grd | Grads], [P | Props]):-
-    items_key_geq_T(Pts, Grd, 2, Pos), % grad+ (>=2)
-    items_key_less_T(Pts, Grd, -1, Neg), % grad- (< -1)
-    length(Pos, NPos), length(Neg, NNeg),
-    NPos + NNeg > 20, % no trivial directions (few brightness changed points)
-    P is NPos/(NNeg + NPos + 10e-10),
-    grad_prop(Points, Grads, Props).
-grad_prop([_ | Points], [_ | Grads], [P | Props]):-
-    P = -1,
-    grad_prop(Points, Grads, Props).
-
 /* direction Test is close to one of direction in Dirs */
 dir_close_to_one_of_dirs(_, []):-
     fail, !.
@@ -0,0 +1,277 @@
+/* Argument decoding
+ *     Arguments are read with the C interface of swi-prolog: lists are
+ *     measured before they are filled, points [X, Y, Z] are read without
+ *     building vectors, and malformed arguments raise type errors instead
+ *     of being read partially.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _ARGS_HPP
+#define _ARGS_HPP
+
+#include <opencv2/core/core.hpp>
+#include <SWI-cpp.h>
+#include <SWI-Prolog.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+/********** declaration **********/
+
+/* fast paths, false if the term is malformed (no exception is raised)
+ * Integers are read as PL_get_integer/PL_get_long do, numbers (integers
+ *     and floats) as PL_get_float does.
+ */
+bool get_number(term_t t, int &v);
+bool get_number(term_t t, long &v);
+bool get_number(term_t t, double &v);
+/* numbers of a list of exactly n elements, of any length if n < 0 */
+template <class Type>
+bool get_list(term_t t, vector<Type> &v, int n = -1);
+/* a list [X, Y, Z] of integers */
+bool get_point(term_t t, Point3i &pt);
+/* a list [A, B, C] of numbers */
+bool get_scalar(term_t t, Scalar &s);
+/* lists of the above */
+bool get_points(term_t t, vector<Point3i> &pts);
+bool get_scalars(term_t t, vector<Scalar> &scalars);
+/* a list [[P1, Q1], ...] of pairs of points */
+bool get_point_pairs(term_t t, vector<pair<Point3i, Point3i> > &pairs);
+/* elements of a proper list, of exactly n elements if n >= 0 */
+bool get_elems(term_t t, vector<PlTerm> &elems, int n = -1);
+
+/* decoding of arguments raising type_error(EXPECTED, TERM), EXPECTED is
+ *     one of integer, number, atom, point ([X, Y, Z] of integers), triple
+ *     ([A, B, C] of numbers), integer_list, number_list, point_list,
+ *     triple_list, point_pair_list and list
+ */
+int term2int(PlTerm t);
+long term2long(PlTerm t);
+double term2double(PlTerm t);
+string term2atom(PlTerm t);
+template <class Type>
+vector<Type> term2vec(PlTerm t, int n = -1);
+Point3i term2point(PlTerm t);
+Scalar term2scalar(PlTerm t);
+vector<Point3i> term2point_vec(PlTerm t);
+vector<Scalar> term2scalar_vec(PlTerm t);
+vector<pair<Point3i, Point3i> > term2point_pair_vec(PlTerm t);
+/* elements of a list, raise type_error(expected, t) if it is not a proper
+ * list (of n elements if n >= 0)
+ */
+vector<PlTerm> term2elems(PlTerm t, const char *expected = "list",
+                          int n = -1);
+
+/*********** implementation ************/
+bool get_number(term_t t, int &v) {
+    return PL_get_integer(t, &v);
+}
+
+bool get_number(term_t t, long &v) {
+    return PL_get_long(t, &v);
+}
+
+bool get_number(term_t t, double &v) {
+    return PL_get_float(t, &v);
+}
+
+/* the n numbers of list t, head and tail are scratch references */
+template <class Type>
+inline bool get_fixed(term_t t, Type *v, int n, term_t head, term_t tail) {
+    PL_put_term(tail, t);
+    for (int i = 0; i < n; i++)
+        if (!PL_get_list(tail, head, tail) || !get_number(head, v[i]))
+            return false;
+    return PL_get_nil(tail);
+}
+
+template <class Type>
+bool get_list(term_t t, vector<Type> &v, int n) {
+    size_t len;
+    if (PL_skip_list(t, 0, &len) != PL_LIST || (n >= 0 && len != (size_t) n))
+        return false;
+    v.resize(len);
+    return len == 0 || get_fixed(t, &v[0], (int) len, PL_new_term_ref(),
+                                 PL_new_term_ref());
+}
+
+bool get_point(term_t t, Point3i &pt) {
+    int c[3];
+    if (!get_fixed(t, c, 3, PL_new_term_ref(), PL_new_term_ref()))
+        return false;
+    pt = Point3i(c[0], c[1], c[2]);
+    return true;
+}
+
+bool get_scalar(term_t t, Scalar &s) {
+    double c[3];
+    if (!get_fixed(t, c, 3, PL_new_term_ref(), PL_new_term_ref()))
+        return false;
+    s = Scalar(c[0], c[1], c[2]);
+    return true;
+}
+
+bool get_points(term_t t, vector<Point3i> &pts) {
+    size_t len;
+    if (PL_skip_list(t, 0, &len) != PL_LIST)
+        return false;
+    pts.resize(len);
+    // the same scratch references for all points
+    term_t list = PL_copy_term_ref(t);
+    term_t elem = PL_new_term_ref();
+    term_t head = PL_new_term_ref(), tail = PL_new_term_ref();
+    int c[3];
+    for (size_t i = 0; i < len; i++) {
+        if (!PL_get_list(list, elem, list) ||
+            !get_fixed(elem, c, 3, head, tail))
+            return false;
+        pts[i] = Point3i(c[0], c[1], c[2]);
+    }
+    return true;
+}
+
+bool get_scalars(term_t t, vector<Scalar> &scalars) {
+    size_t len;
+    if (PL_skip_list(t, 0, &len) != PL_LIST)
+        return false;
+    scalars.resize(len);
+    term_t list = PL_copy_term_ref(t);
+    term_t elem = PL_new_term_ref();
+    term_t head = PL_new_term_ref(), tail = PL_new_term_ref();
+    double c[3];
+    for (size_t i = 0; i < len; i++) {
+        if (!PL_get_list(list, elem, list) ||
+            !get_fixed(elem, c, 3, head, tail))
+            return false;
+        scalars[i] = Scalar(c[0], c[1], c[2]);
+    }
+    return true;
+}
+
+bool get_point_pairs(term_t t, vector<pair<Point3i, Point3i> > &pairs) {
+    size_t len;
+    if (PL_skip_list(t, 0, &len) != PL_LIST)
+        return false;
+    pairs.resize(len);
+    term_t list = PL_copy_term_ref(t);
+    term_t elem = PL_new_term_ref(), pt = PL_new_term_ref();
+    term_t head = PL_new_term_ref(), tail = PL_new_term_ref();
+    int c[3], d[3];
+    for (size_t i = 0; i < len; i++) {
+        // elem = [P, Q]
+        if (!PL_get_list(list, elem, list) ||
+            !PL_get_list(elem, pt, elem) || !get_fixed(pt, c, 3, head, tail) ||
+            !PL_get_list(elem, pt, elem) || !get_fixed(pt, d, 3, head, tail) ||
+            !PL_get_nil(elem))
+            return false;
+        pairs[i] = make_pair(Point3i(c[0], c[1], c[2]),
+                             Point3i(d[0], d[1], d[2]));
+    }
+    return true;
+}
+
+bool get_elems(term_t t, vector<PlTerm> &elems, int n) {
+    size_t len;
+    if (PL_skip_list(t, 0, &len) != PL_LIST || (n >= 0 && len != (size_t) n))
+        return false;
+    elems.clear();
+    elems.reserve(len);
+    term_t list = PL_copy_term_ref(t);
+    for (size_t i = 0; i < len; i++) {
+        term_t head = PL_new_term_ref();
+        if (!PL_get_list(list, head, list))
+            return false;
+        elems.push_back(PlTerm(head));
+    }
+    return true;
+}
+
+int term2int(PlTerm t) {
+    int v;
+    if (!get_number(t.ref, v))
+        throw PlTypeError("integer", t);
+    return v;
+}
+
+long term2long(PlTerm t) {
+    long v;
+    if (!get_number(t.ref, v))
+        throw PlTypeError("integer", t);
+    return v;
+}
+
+double term2double(PlTerm t) {
+    double v;
+    if (!get_number(t.ref, v))
+        throw PlTypeError("number", t);
+    return v;
+}
+
+string term2atom(PlTerm t) {
+    char *s;
+    if (!PL_get_atom_chars(t.ref, &s))
+        throw PlTypeError("atom", t);
+    return string(s);
+}
+
+template <class Type>
+vector<Type> term2vec(PlTerm t, int n) {
+    static_assert((is_same<Type, int>::value)
+                  || (is_same<Type, long>::value)
+                  || (is_same<Type, double>::value),
+                  "Wrong template type for term2vec!");
+    vector<Type> v;
+    if (!get_list(t.ref, v, n))
+        throw PlTypeError(is_same<Type, double>::value ? "number_list"
+                          : "integer_list", t);
+    return v;
+}
+
+Point3i term2point(PlTerm t) {
+    Point3i pt;
+    if (!get_point(t.ref, pt))
+        throw PlTypeError("point", t);
+    return pt;
+}
+
+Scalar term2scalar(PlTerm t) {
+    Scalar s;
+    if (!get_scalar(t.ref, s))
+        throw PlTypeError("triple", t);
+    return s;
+}
+
+vector<Point3i> term2point_vec(PlTerm t) {
+    vector<Point3i> pts;
+    if (!get_points(t.ref, pts))
+        throw PlTypeError("point_list", t);
+    return pts;
+}
+
+vector<Scalar> term2scalar_vec(PlTerm t) {
+    vector<Scalar> scalars;
+    if (!get_scalars(t.ref, scalars))
+        throw PlTypeError("triple_list", t);
+    return scalars;
+}
+
+vector<pair<Point3i, Point3i> > term2point_pair_vec(PlTerm t) {
+    vector<pair<Point3i, Point3i> > pairs;
+    if (!get_point_pairs(t.ref, pairs))
+        throw PlTypeError("point_pair_list", t);
+    return pairs;
+}
+
+vector<PlTerm> term2elems(PlTerm t, const char *expected, int n) {
+    vector<PlTerm> elems;
+    if (!get_elems(t.ref, elems, n))
+        throw PlTypeError(expected, t);
+    return elems;
+}
+
+#endif
@@ -0,0 +1,169 @@
+/* Packed buffers
+ *     Points, numbers and Lab colours in flat arrays behind a handle, so
+ *     pipelines of samplings (points -> colours -> gradients -> counts)
+ *     stay in C++ and lists are only built when they are asked for.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _BUFFER_HPP
+#define _BUFFER_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// item types of buffers
+enum BufferType { BUF_POINTS, BUF_DOUBLES, BUF_LAB };
+// conditions of thresholding, value >= / > / =< / < threshold
+enum BufferCond { COND_GEQ, COND_GT, COND_LEQ, COND_LESS };
+
+/********** declaration **********/
+
+/* a packed buffer
+ * @points: items of a point buffer
+ * @values: items of a number buffer, or 3 values (L, A, B) per item of a
+ *     Lab buffer
+ */
+struct PackedBuffer {
+    int type;
+    vector<Point3i> points;
+    vector<double> values;
+
+    explicit PackedBuffer(int type) : type(type) {}
+    // values per item
+    int width() const { return type == BUF_LAB ? 3 : 1; }
+    // number of items
+    size_t size() const;
+};
+
+// buffers of samplings
+PackedBuffer points_buffer(const vector<Point3i> &points);
+PackedBuffer doubles_buffer(const vector<double> &values);
+PackedBuffer lab_buffer(const vector<Scalar> &colors);
+
+/* items start ... start + len - 1 (0-based) of a buffer, clipped to its
+ *     size
+ */
+PackedBuffer buffer_slice(const PackedBuffer &buf, size_t start, size_t len);
+/* items of a buffer whose keys satisfy "value cond thresh"
+ * @keys: one key per item
+ */
+PackedBuffer buffer_select(const PackedBuffer &buf, const vector<double> &keys,
+                           int cond, double thresh);
+// number of values satisfying "value cond thresh"
+size_t buffer_count(const vector<double> &values, int cond, double thresh);
+// index of the (first) largest value, -1 if there is none
+long buffer_argmax(const vector<double> &values);
+// channel c (0-2) of a Lab buffer
+PackedBuffer buffer_channel(const PackedBuffer &lab, int c);
+/* differences of consecutive values, the first one is 0 (as grad/2 of
+ *     plsampling.pl)
+ */
+PackedBuffer buffer_diff(const vector<double> &values);
+
+/*********** implementation ************/
+size_t PackedBuffer::size() const {
+    return type == BUF_POINTS ? points.size() : values.size() / width();
+}
+
+// whether a value satisfies a condition
+inline bool buffer_cond(double value, int cond, double thresh) {
+    switch (cond) {
+    case COND_GEQ: return value >= thresh;
+    case COND_GT: return value > thresh;
+    case COND_LEQ: return value <= thresh;
+    default: return value < thresh;
+    }
+}
+
+PackedBuffer points_buffer(const vector<Point3i> &points) {
+    PackedBuffer buf(BUF_POINTS);
+    buf.points = points;
+    return buf;
+}
+
+PackedBuffer doubles_buffer(const vector<double> &values) {
+    PackedBuffer buf(BUF_DOUBLES);
+    buf.values = values;
+    return buf;
+}
+
+PackedBuffer lab_buffer(const vector<Scalar> &colors) {
+    PackedBuffer buf(BUF_LAB);
+    buf.values.reserve(3 * colors.size());
+    for (auto it = colors.begin(); it != colors.end(); ++it)
+        for (int c = 0; c < 3; c++)
+            buf.values.push_back((*it)[c]);
+    return buf;
+}
+
+PackedBuffer buffer_slice(const PackedBuffer &buf, size_t start, size_t len) {
+    PackedBuffer re(buf.type);
+    size_t n = buf.size();
+    start = min(start, n);
+    size_t end = start + min(len, n - start);
+    if (buf.type == BUF_POINTS) {
+        re.points.assign(buf.points.begin() + start, buf.points.begin() + end);
+    } else {
+        int w = buf.width();
+        re.values.assign(buf.values.begin() + w * start,
+                         buf.values.begin() + w * end);
+    }
+    return re;
+}
+
+PackedBuffer buffer_select(const PackedBuffer &buf, const vector<double> &keys,
+                           int cond, double thresh) {
+    PackedBuffer re(buf.type);
+    int w = buf.width();
+    size_t n = min(buf.size(), keys.size());
+    for (size_t i = 0; i < n; i++) {
+        if (!buffer_cond(keys[i], cond, thresh))
+            continue;
+        if (buf.type == BUF_POINTS)
+            re.points.push_back(buf.points[i]);
+        else
+            re.values.insert(re.values.end(), buf.values.begin() + w * i,
+                             buf.values.begin() + w * (i + 1));
+    }
+    return re;
+}
+
+size_t buffer_count(const vector<double> &values, int cond, double thresh) {
+    size_t re = 0;
+    for (auto it = values.begin(); it != values.end(); ++it)
+        if (buffer_cond(*it, cond, thresh))
+            re++;
+    return re;
+}
+
+long buffer_argmax(const vector<double> &values) {
+    if (values.empty())
+        return -1;
+    return max_element(values.begin(), values.end()) - values.begin();
+}
+
+PackedBuffer buffer_channel(const PackedBuffer &lab, int c) {
+    PackedBuffer re(BUF_DOUBLES);
+    size_t n = lab.size();
+    re.values.resize(n);
+    for (size_t i = 0; i < n; i++)
+        re.values[i] = lab.values[3 * i + c];
+    return re;
+}
+
+PackedBuffer buffer_diff(const vector<double> &values) {
+    PackedBuffer re(BUF_DOUBLES);
+    re.values.resize(values.size());
+    for (size_t i = 1; i < values.size(); i++)
+        re.values[i] = values[i] - values[i - 1];
+    return re;
+}
+
+#endif
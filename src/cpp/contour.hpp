@@ -0,0 +1,114 @@
+/* Contour templates of ellipses
+ *     The contour of an ellipse is the same for every centre, so it is
+ *     rasterized once around the origin and cached by its shape.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _CONTOUR_HPP
+#define _CONTOUR_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// cached contours, the cache is cleared when it grows larger
+#define CONTOUR_CACHE_SIZE 1024
+
+/********** declaration **********/
+
+/* pixels of the ellipse with semi-axes w (rotated by angle DEG) and h
+ *     around the origin, the same ellipse as ellipse2Poly(Point(0, 0),
+ *     Size(w, h), angle, ...) draws
+ *     Every pixel is the rounded position of a point of the ellipse. The
+ *     contour is 8-connected and ordered (counter-clockwise in x-right,
+ *     y-up axes), starting at the end of the w axis, without duplicates
+ *     and without corner pixels whose neighbours are adjacent. Degenerate
+ *     ellipses (w or h is 0) are segments.
+ */
+vector<Point> ellipse_contour(int w, int h, int angle);
+
+/* get (cached) contour of ellipse param (as get_ellipse_points) */
+shared_ptr<const vector<Point> > get_ellipse_contour(Scalar param);
+
+/*********** implementation ************/
+// whether two pixels are 8-neighbours (or the same)
+inline bool pixel_adjacent(Point p, Point q) {
+    return std::abs(p.x - q.x) <= 1 && std::abs(p.y - q.y) <= 1;
+}
+
+vector<Point> ellipse_contour(int w, int h, int angle) {
+    vector<Point> re;
+    double rad = angle * CV_PI / 180;
+    double c = cos(rad), s = sin(rad);
+    // sampled points move at most 0.5 pixel, so rounded ones are adjacent
+    long n = max(4L, (long) ceil(4 * CV_PI * max(w, h)));
+    re.reserve(n);
+    unordered_set<long long> seen; // thin ellipses may meet themselves
+    auto key = [](Point p) {
+        return ((long long) p.x << 32) ^ (unsigned int) p.y;
+    };
+    for (long k = 0; k < n; k++) {
+        double t = 2 * CV_PI * k / n;
+        double u = w * cos(t), v = h * sin(t);
+        Point q(cvRound(u * c - v * s), cvRound(u * s + v * c));
+        if (seen.count(key(q)))
+            continue;
+        // drop corners: the previous pixel is not needed if q touches the
+        // one before it
+        while (re.size() >= 2 && pixel_adjacent(re[re.size() - 2], q)) {
+            seen.erase(key(re.back()));
+            re.pop_back();
+        }
+        seen.insert(key(q));
+        re.push_back(q);
+    }
+    // corners where the contour closes
+    while (re.size() >= 3 && pixel_adjacent(re[re.size() - 2], re[0]))
+        re.pop_back();
+    while (re.size() >= 3 && pixel_adjacent(re.back(), re[1]))
+        re.erase(re.begin());
+    return re;
+}
+
+shared_ptr<const vector<Point> > get_ellipse_contour(Scalar param) {
+    typedef tuple<int, int, int> Key;
+    static map<Key, shared_ptr<const vector<Point> > > cache;
+    static mutex mtx;
+
+    // shorter axis first as get_ellipse_points, integer angle in [0, 360)
+    int w = std::abs((int) param[0]);
+    int h = std::abs((int) param[1]);
+    if (w > h)
+        swap(w, h);
+    int angle = ((int) param[2]) % 360;
+    if (angle < 0)
+        angle += 360;
+    Key key(w, h, angle);
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = cache.find(key);
+        if (it != cache.end())
+            return it->second;
+    }
+    // rasterize unlocked, other shapes can be served meanwhile
+    shared_ptr<const vector<Point> > contour =
+        make_shared<vector<Point> >(ellipse_contour(w, h, angle));
+    lock_guard<mutex> lock(mtx);
+    if (cache.size() >= CONTOUR_CACHE_SIZE)
+        cache.clear(); // contours in use are kept alive by their holders
+    cache[key] = contour;
+    return contour;
+}
+
+#endif
@@ -7,7 +7,8 @@
 #include "draw.hpp"
 #include "sampler.hpp"
 #include "utils.hpp"
-#include "memread.hpp"
+#include "handle.hpp"
+#include "errors.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -16,18 +17,19 @@
 
 /* get color Lab value from prolog term */
 Scalar term2color(PlTerm C) {
-    char *p4 = (char*) C;
+    const string name = term2atom(C);
+    char p4 = name.empty() ? ' ' : name[0];
     Scalar color; // color
     // color
-    if (p4[0] == 'r' || p4[0] == 'R')
+    if (p4 == 'r' || p4 == 'R')
         color = RED;
-    else if (p4[0] == 'g' || p4[0] == 'G')
+    else if (p4 == 'g' || p4 == 'G')
         color = GREEN;
-    else if (p4[0] == 'b' || p4[0] == 'B')
+    else if (p4 == 'b' || p4 == 'B')
         color = BLUE;
-    else if (p4[0] == 'y' || p4[0] == 'Y')
+    else if (p4 == 'y' || p4 == 'Y')
         color = YELLOW;
-    else if (p4[0] == 'w' || p4[0] == 'W')
+    else if (p4 == 'w' || p4 == 'W')
         color = WHITE;
     else
         color = BLACK;
@@ -42,22 +44,16 @@ Scalar term2color(PlTerm C) {
  */
 PREDICATE(draw_line_seg, 4) {
     // parsing arguments
-    char *p1 = (char*) A1;
-    const string add_seq(p1); // address
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
-    vector<int> start_v = list2vec<int>(A2, 3);
-    vector<int> end_v = list2vec<int>(A3, 3);
-    Scalar start(start_v[0], start_v[1], start_v[2]); // start point
-    Scalar end(end_v[0], end_v[1], end_v[2]); // end point
+    ImgSeq *seq = term2seq(A1);
+    Point3i start = term2point(A2); // start point
+    Point3i end = term2point(A3); // end point
     Scalar color = term2color(A4); // color
     // get all line points
-    Scalar bound((*seq)[0].cols, (*seq)[0].rows, seq->size());
-    vector<Scalar> line_points = get_line_seg_points(start, end, bound);
+    vector<Point3i> line_points = get_line_seg_points(start, end, seq->bound());
     // draw
-    for (auto it = line_points.begin(); it != line_points.end(); ++it) {
-        Scalar pt = (Scalar) *it;
-        cv_draw_point((*seq)[pt[2]], Point(pt[0], pt[1]), color);
-    }
+    for (auto it = line_points.begin(); it != line_points.end(); ++it)
+        cv_draw_point(seq->frame(it->z), Point(it->x, it->y), color);
+    seq->invalidate();
     return TRUE;
 }
     
@@ -69,11 +65,14 @@ PREDICATE(draw_line_seg, 4) {
  */
 PREDICATE(draw_line_seg_2d, 4) {
     // parsing arguments
-    char *p1 = (char*) A1;
-    const string add_img(p1); // address
-    Mat *img = str2ptr<Mat>(add_img);
-    vector<int> start_v = list2vec<int>(A2, 2);
-    vector<int> end_v = list2vec<int>(A3, 2);
+    Mat *img = term2img(A1);
+    // [X, Y] or [X, Y, Z] (the frame is ignored)
+    vector<int> start_v = term2vec<int>(A2);
+    vector<int> end_v = term2vec<int>(A3);
+    if (start_v.size() < 2 || start_v.size() > 3)
+        throw PlTypeError("point", A2);
+    if (end_v.size() < 2 || end_v.size() > 3)
+        throw PlTypeError("point", A3);
     Scalar start(start_v[0], start_v[1], -1); // start point
     Scalar end(end_v[0], end_v[1], -1); // end point
     Scalar color = term2color(A4); // color    
@@ -82,6 +81,7 @@ PREDICATE(draw_line_seg_2d, 4) {
                  Point(start[0], start[1]),
                  Point(end[0], end[1]),
                  color);
+    invalidate_img(A1);
     return TRUE;
 }
 
@@ -92,19 +92,16 @@ PREDICATE(draw_line_seg_2d, 4) {
  */
 PREDICATE(draw_points, 3) {
     // parsing arguments
-    char *p1 = (char*) A1;
-    const string add_seq(p1); // address
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
-    vector<Scalar> pts = point_list2vec(A2);
+    ImgSeq *seq = term2seq(A1);
+    vector<Point3i> pts = term2point_vec(A2);
     if (pts.empty())
         return TRUE;
     else {
         Scalar color = term2color(A3); // color    
         // draw
-        for (auto it = pts.begin(); it != pts.end(); ++it) {
-            Scalar pt = (Scalar) *it;
-            cv_draw_point((*seq)[pt[2]], Point(pt[0], pt[1]), color);
-        }
+        for (auto it = pts.begin(); it != pts.end(); ++it)
+            cv_draw_point(seq->frame(it->z), Point(it->x, it->y), color);
+        seq->invalidate();
         return TRUE;
     }
 }
@@ -116,19 +113,16 @@ PREDICATE(draw_points, 3) {
  */
 PREDICATE(draw_points_2d, 3) {
     // parsing arguments
-    char *p1 = (char*) A1;
-    const string add_img(p1); // address
-    Mat *img = str2ptr<Mat>(add_img);
-    vector<Scalar> pts = point_list2vec(A2);
+    Mat *img = term2img(A1);
+    vector<Point3i> pts = term2point_vec(A2);
     if (pts.empty())
         return TRUE;
     else {
         Scalar color = term2color(A3); // color    
         // draw
-        for (auto it = pts.begin(); it != pts.end(); ++it) {
-            Scalar pt = (Scalar) *it;
-            cv_draw_point(*img, Point(pt[0], pt[1]), color);
-        }
+        for (auto it = pts.begin(); it != pts.end(); ++it)
+            cv_draw_point(*img, Point(it->x, it->y), color);
+        invalidate_img(A1);
         return TRUE;
     }
 }
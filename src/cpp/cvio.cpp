@@ -5,7 +5,9 @@
  */
 
 #include "io.hpp"
-#include "memread.hpp"
+#include "imgseq.hpp"
+#include "seqfile.hpp"
+#include "handle.hpp"
 #include "errors.hpp"
 #include "utils.hpp"
 
@@ -21,424 +23,375 @@
 using namespace std;
 using namespace cv;
 
+/* unify ADD with a new handle of an image sequence,
+ * parent is the resource the sequence depends on (NULL if none)
+ */
+int put_seq(PlTerm add, ImgSeq *imgseq, Resource *parent,
+            string pred_name, int arg) {
+    Resource *res = new Resource(KIND_SEQ, imgseq, parent);
+    // the resource is freed by atom garbage collection if unifying fails
+    if (!unify_handle(add, res))
+        return PUT_ERROR(pred_name, arg, "ADD", "HANDLE");
+    return TRUE;
+}
+
 /* load_img(PATH, ADD)
- * load image from PATH into stack ADD
- * also automaticall assert a size_2d(ADD, width, height) of the image
+ * load image from PATH, ADD is a handle of the image
+ * its size is given by img_size/3
  */
 PREDICATE(load_img, 2) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        const string path(p1);
-        Mat* img = cv_load_img(path);
-        string add = ptr2str(img); // address of image in stack
-        term_t t2 = PL_new_term_ref();
-        if (PL_put_atom_chars(t2, add.c_str())) {
-            A2 = PlTerm(t2);
-            // assert size_2d
-            int col = img->cols;
-            int row = img->rows;
-            PlTermv size_2d_args(3);
-            size_2d_args[0] = A2;
-            size_2d_args[1] = col;
-            size_2d_args[2] = row;
-            PlTermv size_2d_atom(1);
-            size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-            PlCall("assertz", size_2d_atom);
-            return TRUE;
-        } else
-            return PUT_ERROR("load_img/2", 2, "ADD", "STRING");
-    } else
-        return LOAD_ERROR("load_img/2", 1, "PATH", "STRING");
+    const string path = term2atom(A1);
+    Mat* img = cv_load_img(path);
+    Resource *res = new Resource(KIND_IMG, img);
+    if (!unify_handle(A2, res))
+        return PUT_ERROR("load_img/2", 2, "ADD", "HANDLE");
+    return TRUE;
 }
 
 /* load_video(PATH, ADD)
- * load a video into stack
- * also automaticall assert size_2d(ADD, width, height)
- *    and size_3d(ADD, width, height, duration) of the video.
+ * load a video, ADD is a handle of the video
+ * its size is given by video_size/4
  */
 PREDICATE(load_video, 2) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        const string path(p1);        
-        VideoCapture *vid = cv_load_video(path);
-        if (vid == NULL)
-            return FALSE;
-        string add = ptr2str(vid); // address of video in stack
-        // assert size_3d and size_2d
-        term_t t2 = PL_new_term_ref();
-        if (PL_put_atom_chars(t2, add.c_str())) {
-            A2 = PlTerm(t2);
-            int wid = vid->get(CAP_PROP_FRAME_WIDTH);
-            int hei = vid->get(CAP_PROP_FRAME_HEIGHT);
-            int dur = vid->get(CAP_PROP_FRAME_COUNT); // duration
-            // 2d
-            PlTermv size_2d_args(3);
-            size_2d_args[0] = A2;
-            size_2d_args[1] = wid;
-            size_2d_args[2] = hei;
-            PlTermv size_2d_atom(1);
-            size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-            // 3d
-            PlTermv size_3d_args(4);
-            size_3d_args[0] = A2;
-            size_3d_args[1] = wid;
-            size_3d_args[2] = hei;
-            size_3d_args[3] = dur;
-            PlTermv size_3d_atom(1);
-            size_3d_atom[0] = PlCompound("size_3d", size_3d_args);
-            // assertion
-            PlCall("assertz", size_2d_atom);
-            PlCall("assertz", size_3d_atom);
-            return TRUE;
-        } else
-            return PUT_ERROR("load_video/2", 2, "ADD", "STRING");
-    } else
-        return LOAD_ERROR("load_video/2", 1, "PATH", "STRING");
+    const string path = term2atom(A1);
+    VideoCapture *vid = cv_load_video(path);
+    if (vid == NULL)
+        return FALSE;
+    Resource *res = new Resource(KIND_VIDEO, vid);
+    if (!unify_handle(A2, res))
+        return PUT_ERROR("load_video/2", 2, "ADD", "HANDLE");
+    return TRUE;
+}
+
+/* parse options of loading a video as image sequence
+ * @OPTS = [threads(N), start(S), end(E), step(T), crop(X, Y, W, H),
+ *     downscale(F)]: option list, unknown options are ignored
+ */
+SeqOptions term2seq_options(PlTerm opts) {
+    SeqOptions opt;
+    vector<PlTerm> elems = term2elems(opts);
+    for (auto it = elems.begin(); it != elems.end(); ++it) {
+        PlTerm e = *it;
+        if (e.type() != PL_TERM)
+            continue;
+        const string name(e.name());
+        if (e.arity() == 1) {
+            if (name == "threads")
+                opt.threads = term2int(e[1]);
+            else if (name == "start")
+                opt.start = term2long(e[1]);
+            else if (name == "end")
+                opt.end = term2long(e[1]);
+            else if (name == "step")
+                opt.step = term2long(e[1]);
+            else if (name == "downscale")
+                opt.downscale = term2double(e[1]);
+        } else if (e.arity() == 4 && name == "crop")
+            opt.crop = Rect(term2int(e[1]), term2int(e[2]), term2int(e[3]), term2int(e[4]));
+    }
+    return opt;
+}
+
+/* transform the video (ADD_V) into an image sequence (ADD_I) with color
+ * conversion code
+ */
+int video2seq(PlTerm ADD_V, PlTerm ADD_I, int code, SeqOptions opt,
+              string pred_name) {
+    VideoCapture *vid = term2video(ADD_V);
+    ImgSeq *imgseq = cv_video2seq(vid, code, opt);
+    if (imgseq == NULL)
+        return FALSE;
+    return put_seq(ADD_I, imgseq, NULL, pred_name, 2);
 }
 
 /* video2imgseq(ADD_V, ADD_I)
  * transform the video (ADD_V) into a sequence of image (ADD_I)
- * the images are stored in a STL vector<Mat>
+ * the images are stored in a contiguous volume, preprocessing uses all cores
  */
 PREDICATE(video2imgseq, 2) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        const string add_v(p1);
-        VideoCapture *vid = str2ptr<VideoCapture>(add_v);
-        vector<Mat> *imgseq = cv_video2imgseq(vid);
-        string add_i = ptr2str(imgseq);
-        term_t t2 = PL_new_term_ref();
-
-        // assert size_3d and size_2d
-        if (PL_put_atom_chars(t2, add_i.c_str())) {
-            A2 = PlTerm(t2);
-            int wid = vid->get(CAP_PROP_FRAME_WIDTH);
-            int hei = vid->get(CAP_PROP_FRAME_HEIGHT);
-            int dur = vid->get(CAP_PROP_FRAME_COUNT); // duration
-            // 2d
-            PlTermv size_2d_args(3);
-            size_2d_args[0] = A2;
-            size_2d_args[1] = wid;
-            size_2d_args[2] = hei;
-            PlTermv size_2d_atom(1);
-            size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-            // 3d
-            PlTermv size_3d_args(4);
-            size_3d_args[0] = A2;
-            size_3d_args[1] = wid;
-            size_3d_args[2] = hei;
-            size_3d_args[3] = dur;
-            PlTermv size_3d_atom(1);
-            size_3d_atom[0] = PlCompound("size_3d", size_3d_args);
-            // assertion
-            PlCall("assertz", size_2d_atom);
-            PlCall("assertz", size_3d_atom);
-            return TRUE;
-        } else
-            return PUT_ERROR("video2imgseq/2", 2, "ADD_I", "STRING");
-    } else
-        return LOAD_ERROR("video2imgseq/2", 1, "ADD_V", "STRING");
+    return video2seq(A1, A2, COLOR_BGR2Lab, SeqOptions(), "video2imgseq/2");
+}
+
+/* video2imgseq(ADD_V, ADD_I, OPTS)
+ * same as video2imgseq/2 with options, seq_size/4 gives the size of the
+ * loaded sequence
+ * @OPTS: list of
+ *     threads(N): N preprocessing (median blur and Lab conversion)
+ *         workers, threads(1) loads the video serially
+ *     start(S), end(E), step(T): only load frames S, S + T, ... < E
+ *         (frame Z in the sequence is frame S + Z * T of the video)
+ *     crop(X, Y, W, H): only load the W x H rectangle at (X, Y)
+ *     downscale(F): shrink the (cropped) frames by factor F >= 1
+ */
+PREDICATE(video2imgseq, 3) {
+    return video2seq(A1, A2, COLOR_BGR2Lab, term2seq_options(A3),
+                     "video2imgseq/3");
 }
 
 /* video2greyseq(ADD_V, ADD_I)
  * transform the video (ADD_V) into a sequence of grey scaled image (ADD_I)
- * the images are stored in a STL vector<Mat>
+ * the images are stored in a contiguous volume, preprocessing uses all cores
  */
 PREDICATE(video2greyseq, 2) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        const string add_v(p1);
-        VideoCapture *vid = str2ptr<VideoCapture>(add_v);
-        vector<Mat> *imgseq = cv_video2greyseq(vid);
-        string add_i = ptr2str(imgseq);
-        term_t t2 = PL_new_term_ref();
-
-        // assert size_3d and size_2d
-        if (PL_put_atom_chars(t2, add_i.c_str())) {
-            A2 = PlTerm(t2);
-            int wid = vid->get(CAP_PROP_FRAME_WIDTH);
-            int hei = vid->get(CAP_PROP_FRAME_HEIGHT);
-            int dur = vid->get(CAP_PROP_FRAME_COUNT); // duration
-            // 2d
-            PlTermv size_2d_args(3);
-            size_2d_args[0] = A2;
-            size_2d_args[1] = wid;
-            size_2d_args[2] = hei;
-            PlTermv size_2d_atom(1);
-            size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-            // 3d
-            PlTermv size_3d_args(4);
-            size_3d_args[0] = A2;
-            size_3d_args[1] = wid;
-            size_3d_args[2] = hei;
-            size_3d_args[3] = dur;
-            PlTermv size_3d_atom(1);
-            size_3d_atom[0] = PlCompound("size_3d", size_3d_args);
-            // assertion
-            PlCall("assertz", size_2d_atom);
-            PlCall("assertz", size_3d_atom);
-            return TRUE;
-        } else
-            return PUT_ERROR("video2imgseq/2", 2, "ADD_I", "STRING");
-    } else
-        return LOAD_ERROR("video2imgseq/2", 1, "ADD_V", "STRING");
+    return video2seq(A1, A2, COLOR_BGR2GRAY, SeqOptions(), "video2greyseq/2");
+}
+
+/* video2greyseq(ADD_V, ADD_I, OPTS)
+ * same as video2greyseq/2 with options, see video2imgseq/3
+ */
+PREDICATE(video2greyseq, 3) {
+    return video2seq(A1, A2, COLOR_BGR2GRAY, term2seq_options(A3),
+                     "video2greyseq/3");
+}
+
+/* video2imgseq_lazy(ADD_V, BUDGET, ADD_I)
+ * make an image sequence (ADD_I) of video (ADD_V) whose frames are decoded
+ * and transformed to Lab color on first access; at most BUDGET decoded
+ * frames are kept in memory, including the frames of image handles
+ * (seq_img/3). The sequence keeps the video open, so the video may be
+ * released before the sequence. The depth is the frame count reported by
+ * the video, frames that cannot be read raise existence_error(frame, Z)
+ * and, since the reported count may be too large, shrink the depth to Z.
+ */
+PREDICATE(video2imgseq_lazy, 3) {
+    Resource *vid_res = term2resource(A1, KIND_VIDEO);
+    int budget = term2int(A2);
+    if (budget <= 0)
+        return LOAD_ERROR("video2imgseq_lazy/3", 2, "BUDGET", "NUMBER > 0");
+    ImgSeq *imgseq = new LazySeq((VideoCapture *) vid_res->obj, budget);
+    return put_seq(A3, imgseq, vid_res, "video2imgseq_lazy/3", 3);
+}
+
+/* save_imgseq(ADD, PATH)
+ * save image sequence ADD (already preprocessed frames) into cache file
+ * PATH, which can be mapped back with mmap_imgseq/2
+ */
+PREDICATE(save_imgseq, 2) {
+    ImgSeq *seq = term2seq(A1);
+    const string path = term2atom(A2);
+    return cv_save_imgseq(seq, path) ? TRUE : FALSE;
+}
+
+/* mmap_imgseq(PATH, ADD)
+ * map an image sequence cache file (saved by save_imgseq/2) into memory,
+ * frames are not copied nor decoded. Release it with release_imgseq/1.
+ */
+PREDICATE(mmap_imgseq, 2) {
+    const string path = term2atom(A1);
+    ImgSeq *imgseq = cv_mmap_imgseq(path);
+    if (imgseq == NULL)
+        return FALSE;
+    return put_seq(A2, imgseq, NULL, "mmap_imgseq/2", 2);
 }
 
 /* release_img(ADD)
- * release image ADD in stack and retract size info
+ * release image ADD, images of a sequence (seq_img/3) are released with
+ * the sequence
  */
 PREDICATE(release_img, 1) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        string add(p1);
-        Mat* img = str2ptr<Mat>(add);
-        // retract size_2d
-        PlTermv size_2d_args(3);
-        size_2d_args[0] = A1;
-        PlTermv size_2d_atom(1);
-        size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-        PlCall("retractall", size_2d_atom);
-        // remove img from memory
-        delete img;
-        return TRUE;
-    } else
-        return LOAD_ERROR("release_img/1", 1, "ADD", "STRING");
+    release_handle(A1, KIND_IMG);
+    return TRUE;
 }
 
 /* release_video(ADD)
- * release a video in stack and retract size info
+ * release a video, it is closed after the lazy image sequences made from
+ * it are released as well
  */
 PREDICATE(release_video, 1) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        string add(p1);
-        VideoCapture *vid = str2ptr<VideoCapture>(add);
-        // retract size_2d
-        PlTermv size_2d_args(3);
-        size_2d_args[0] = A1;
-        PlTermv size_2d_atom(1);
-        size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-        PlCall("retractall", size_2d_atom);
-        // retract size_3d
-        PlTermv size_3d_args(4);
-        size_3d_args[0] = A1;
-        PlTermv size_3d_atom(1);
-        size_3d_atom[0] = PlCompound("size_3d", size_3d_args);
-        PlCall("retractall", size_3d_atom);
-        // remove video from memory
-        vid->release();
-        delete vid;
-        return TRUE;
-    } else
-        return LOAD_ERROR("release_video/1", 1, "ADD", "STRING");
+    release_handle(A1, KIND_VIDEO);
+    return TRUE;
 }
 
 /* release_imgseq(ADD)
- * release an image sequence in stack
+ * release an image sequence, the frames are freed once no image of the
+ * sequence (seq_img/3) is referenced any more
  */
 PREDICATE(release_imgseq, 1) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        const string add(p1);
-        vector<Mat> *imgseq = str2ptr<vector<Mat>>(add);
-        // retract size_2d
-        PlTermv size_2d_args(3);
-        size_2d_args[0] = A1;
-        PlTermv size_2d_atom(1);
-        size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-        PlCall("retractall", size_2d_atom);
-        // retract size_3d
-        PlTermv size_3d_args(4);
-        size_3d_args[0] = A1;
-        PlTermv size_3d_atom(1);
-        size_3d_atom[0] = PlCompound("size_3d", size_3d_args);
-        PlCall("retractall", size_3d_atom);
-        // remove image sequence from memory
-        delete imgseq;
-        return TRUE;
-    } else
-        return LOAD_ERROR("release_video/1", 1, "ADD", "STRING");
+    release_handle(A1, KIND_SEQ);
+    return TRUE;
+}
+
+/* img_size(IMG, W, H)
+ * width and height of image IMG
+ */
+PREDICATE(img_size, 3) {
+    Mat *img = term2img(A1);
+    return (A2 = img->cols) && (A3 = img->rows);
+}
+
+/* video_size(VID, W, H, D)
+ * frame width, height and number of frames (duration) of video VID
+ */
+PREDICATE(video_size, 4) {
+    VideoCapture *vid = term2video(A1);
+    int wid = vid->get(CAP_PROP_FRAME_WIDTH);
+    int hei = vid->get(CAP_PROP_FRAME_HEIGHT);
+    int dur = vid->get(CAP_PROP_FRAME_COUNT);
+    return (A2 = wid) && (A3 = hei) && (A4 = dur);
+}
+
+/* seq_size(SEQ, W, H, D)
+ * frame width, height and number of frames (duration) of image sequence SEQ
+ */
+PREDICATE(seq_size, 4) {
+    ImgSeq *seq = term2seq(A1);
+    return (A2 = seq->width()) && (A3 = seq->height()) && (A4 = seq->depth());
+}
+
+/* get size of any live handle, dur is -1 for images */
+bool handle_size(PlTerm add, int &wid, int &hei, int &dur) {
+    switch (handle_kind(add)) {
+    case KIND_IMG: {
+        Mat *img = term2img(add);
+        wid = img->cols;
+        hei = img->rows;
+        dur = -1;
+        return true;
+    }
+    case KIND_VIDEO: {
+        VideoCapture *vid = term2video(add);
+        wid = vid->get(CAP_PROP_FRAME_WIDTH);
+        hei = vid->get(CAP_PROP_FRAME_HEIGHT);
+        dur = vid->get(CAP_PROP_FRAME_COUNT);
+        return true;
+    }
+    case KIND_SEQ: {
+        ImgSeq *seq = term2seq(add);
+        wid = seq->width();
+        hei = seq->height();
+        dur = seq->depth();
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/* size_2d(ADD, W, H)
+ * compatibility with the size_2d facts of former versions: width and
+ * height of image, video or image sequence ADD, fails if ADD is not a
+ * (live) handle
+ */
+PREDICATE(size_2d, 3) {
+    int wid, hei, dur;
+    if (!handle_size(A1, wid, hei, dur))
+        return FALSE;
+    return (A2 = wid) && (A3 = hei);
+}
+
+/* size_3d(ADD, W, H, D)
+ * compatibility with the size_3d facts of former versions: size of video
+ * or image sequence ADD, fails if ADD is not a (live) handle of them
+ */
+PREDICATE(size_3d, 4) {
+    int wid, hei, dur;
+    if (!handle_size(A1, wid, hei, dur) || dur < 0)
+        return FALSE;
+    return (A2 = wid) && (A3 = hei) && (A4 = dur);
 }
 
 /* showimg_win(ADD, WINDOW_NAME)
  * show image in a window
  */
 PREDICATE(showimg_win, 2) {
-    term_t t1 = A1.ref;
-    term_t t2 = A2.ref;
-    char *p1;
-    char *p2;
-    if (PL_get_atom_chars(t1, &p1)) {
-        string add(p1);
-        Mat* img = str2ptr<Mat>(p1);
-        if (PL_get_atom_chars(t2, &p2)) {
-            string window_name(p2);
-            namedWindow(window_name, WINDOW_AUTOSIZE);
-            Mat frame = img->clone();
-            cvtColor(frame, frame, COLOR_Lab2BGR);
-            imshow(window_name, frame);
-            waitKey(0);
-            destroyWindow(window_name);
-            return TRUE;
-        } else
-            return LOAD_ERROR("showimg_win/2", 2,
-                              "WINDOW_NAME", "STRING");
-    } else
-        return LOAD_ERROR("showimg_win/2", 1, "ADD", "STRING");
+    Mat* img = term2img(A1);
+    const string window_name = term2atom(A2);
+    namedWindow(window_name, WINDOW_AUTOSIZE);
+    Mat frame = img->clone();
+    cvtColor(frame, frame, COLOR_Lab2BGR);
+    imshow(window_name, frame);
+    waitKey(0);
+    destroyWindow(window_name);
+    return TRUE;
 }
 
 /* showvid_win(ADD, WINDOW_NAME)
- * show a video in stack (ADD)
+ * show a video (ADD)
  */
 PREDICATE(showvid_win, 2) {
-    term_t t1 = A1.ref;
-    term_t t2 = A2.ref;
-    char *p1;
-    char *p2;
-    if (PL_get_atom_chars(t1, &p1)) {
-        if (PL_get_atom_chars(t2, &p2)) {
-            string add(p1);
-            string window_name(p2);
-
-            VideoCapture *vid = str2ptr<VideoCapture>(add);
-            long frame_total = vid->get(CV_CAP_PROP_FRAME_COUNT);
-            long frame_start = 0;
-            long frame_end = frame_total - 1;
-            double frame_rate = vid->get(CV_CAP_PROP_FPS);
-            Mat frame;
-            namedWindow(window_name);
-            int delay = 1000/frame_rate;
-            bool stop = false;
-            long frame_current = frame_start;
-            while(!stop) {
-                if(!vid->read(frame)) {
-                    cerr << "Reading frame " << frame_current
-                         << " failed" << endl;
-                    return FALSE;
-                }
-                imshow(window_name, frame);
-                int c = waitKey(delay);
-                if((char) c == 27 || frame_current > frame_end)
-                    stop = true;
-                else if(c >= 0)
-                    waitKey(0);
-                ++frame_current;
-            }
-            destroyWindow(window_name);
-            return TRUE;
-        } else
-            return LOAD_ERROR("showvid_win/2", 2, "WINDOW_NAME", "STRING");
-    } else
-        return LOAD_ERROR("showvid_win/2", 1, "ADD", "STRING");
+    VideoCapture *vid = term2video(A1);
+    const string window_name = term2atom(A2);
+    long frame_total = vid->get(CV_CAP_PROP_FRAME_COUNT);
+    long frame_start = 0;
+    long frame_end = frame_total - 1;
+    double frame_rate = vid->get(CV_CAP_PROP_FPS);
+    Mat frame;
+    namedWindow(window_name);
+    int delay = 1000/frame_rate;
+    bool stop = false;
+    long frame_current = frame_start;
+    while(!stop) {
+        if(!vid->read(frame)) {
+            cerr << "Reading frame " << frame_current
+                 << " failed" << endl;
+            return FALSE;
+        }
+        imshow(window_name, frame);
+        int c = waitKey(delay);
+        if((char) c == 27 || frame_current > frame_end)
+            stop = true;
+        else if(c >= 0)
+            waitKey(0);
+        ++frame_current;
+    }
+    destroyWindow(window_name);
+    return TRUE;
 }
 
 /* showseq_win(ADD, WINDOW_NAME)
- * show a video in stack (ADD)
+ * show an image sequence (ADD)
  */
 PREDICATE(showseq_win, 2) {
-    term_t t1 = A1.ref;
-    term_t t2 = A2.ref;
-    char *p1;
-    char *p2;
-    if (PL_get_atom_chars(t1, &p1)) {
-        if (PL_get_atom_chars(t2, &p2)) {
-            string add(p1);
-            string window_name(p2);
-            vector<Mat> *seq = str2ptr<vector<Mat>>(add);
-            long frame_total = seq->size();
-            long frame_start = 0;
-            long frame_end = frame_total;
-            double frame_rate = 24;
-            Mat frame;
-            namedWindow(window_name);
-            int delay = 1000/frame_rate;
-            bool stop = false;
-            long frame_current = frame_start;
-            for (auto it = seq->begin(); it != seq->end() && !stop; ++it) {
-                frame = (Mat) *it;
-                Mat frame_copy = frame.clone();
-                cvtColor(frame_copy, frame_copy, COLOR_Lab2BGR);
-                imshow(window_name, frame_copy);
-                int c = waitKey(delay);
-                if((char) c == 27 || frame_current > frame_end)
-                    stop = true;
-                else if(c >= 0)
-                    waitKey(0);
-                ++frame_current;
-            }
-            destroyWindow(window_name);
-            return TRUE;
-        } else
-            return LOAD_ERROR("showseq_win/2", 2, "WINDOW_NAME", "STRING");
-    } else
-        return LOAD_ERROR("showseq_win/2", 1, "ADD", "STRING");    
+    ImgSeq *seq = term2seq(A1);
+    const string window_name = term2atom(A2);
+    long frame_total = seq->depth();
+    long frame_start = 0;
+    long frame_end = frame_total;
+    double frame_rate = 24;
+    Mat frame;
+    namedWindow(window_name);
+    int delay = 1000/frame_rate;
+    bool stop = false;
+    long frame_current = frame_start;
+    for (int z = 0; z < frame_total && !stop; z++) {
+        frame = seq->frame(z);
+        Mat frame_copy = frame.clone();
+        cvtColor(frame_copy, frame_copy, COLOR_Lab2BGR);
+        imshow(window_name, frame_copy);
+        int c = waitKey(delay);
+        if((char) c == 27 || frame_current > frame_end)
+            stop = true;
+        else if(c >= 0)
+            waitKey(0);
+        ++frame_current;
+    }
+    destroyWindow(window_name);
+    return TRUE;
 }
 
 /* seq_img(SEQ, IDX, IMG)
  * get an image (IMG) from image sequence (SEQ), starting from 0
+ * the same frame always gives the same handle, the frame stays valid
+ * while IMG is referenced, even if SEQ is released
  */
 PREDICATE(seq_img, 3) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        string add(p1);
-        vector<Mat> *seq = str2ptr<vector<Mat>>(add);
-        
-        term_t t2 = A2.ref;
-        int p2;
-        if (PL_get_integer(t2, &p2)) {
-            if (p2 < 0 || p2 >= (int) seq->size())
-                return LOAD_ERROR("seq_img/3", 2, "IDX",
-                                  " 0 < NUMBER < size");
-            Mat *img = element_ptr_in_vector<Mat>(seq, p2);
-            string add2 = ptr2str(img);
-            term_t t3 = PL_new_term_ref();
-           
-            if (PL_put_atom_chars(t3, add2.c_str())) {
-                A3 = PlTerm(t3);
-                // if no size_2d(A3, _, _) fact, assert it
-                PlTermv av_size(3);
-                av_size[0] = A3;
-                PlQuery q("size_2d", av_size);
-                if (q.next_solution())
-                    return TRUE;
-                int col = img->cols;
-                int row = img->rows;
-                PlTermv size_2d_args(3);
-                size_2d_args[0] = A3;
-                size_2d_args[1] = col;
-                size_2d_args[2] = row;
-                PlTermv size_2d_atom(1);
-                size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-                PlCall("assertz", size_2d_atom);
-                return TRUE;
-            } else
-                return PUT_ERROR("seq_img/3", 3, "IMG", "STRING");
-        } else
-            return LOAD_ERROR("seq_img/3", 2, "IDX", "NUMBER");
-    } else
-        return LOAD_ERROR("seq_img/3", 1, "SEQ", "STRING");
+    Resource *res = term2resource(A1, KIND_SEQ);
+    ImgSeq *seq = (ImgSeq *) res->obj;
+    int idx = term2int(A2);
+    if (idx < 0 || idx >= seq->depth())
+        return LOAD_ERROR("seq_img/3", 2, "IDX", " 0 < NUMBER < size");
+    if (!unify_handle(A3, res, idx))
+        return PUT_ERROR("seq_img/3", 3, "IMG", "HANDLE");
+    return TRUE;
 }
 
 /* close_window(WINDOW_NAME)
  * close a visualizing window
  */
 PREDICATE(close_window, 1) {
-    term_t t1 = A1.ref;
-    char *p1;
-    if (PL_get_atom_chars(t1, &p1)) {
-        string window_name(p1);
-        destroyWindow(window_name);
-        return TRUE;
-    } else
-        return LOAD_ERROR("close_window/1", 1, "ADD", "STRING");
+    const string window_name = term2atom(A1);
+    destroyWindow(window_name);
+    return TRUE;
 }
 
 /* close_all_windows
@@ -453,25 +406,11 @@ PREDICATE(close_all_windows, 0) {
  * clone an image (mostly for drawing), REMEMBER TO RELEASE IT!
  */
 PREDICATE(clone_img, 2) {
-    char *p1;
-    if (!(p1 = (char*) A1))
-        return FALSE;
-    const string add_img(p1); // address
-    Mat *img = str2ptr<Mat>(add_img);
+    Mat *img = term2img(A1);
     Mat *newimg = new Mat(img->clone());
-    // convert returning
-    string add = ptr2str(newimg);
-    A2 = PlTerm(add.c_str());    
-    // assert size_2d
-    int col = img->cols;
-    int row = img->rows;
-    PlTermv size_2d_args(3);
-    size_2d_args[0] = A2;
-    size_2d_args[1] = col;
-    size_2d_args[2] = row;
-    PlTermv size_2d_atom(1);
-    size_2d_atom[0] = PlCompound("size_2d", size_2d_args);
-    PlCall("assertz", size_2d_atom);
+    Resource *res = new Resource(KIND_IMG, newimg);
+    if (!unify_handle(A2, res))
+        return PUT_ERROR("clone_img/2", 2, "IMG2", "HANDLE");
     return TRUE;
 }
 
@@ -479,36 +418,14 @@ PREDICATE(clone_img, 2) {
  * clone an image sequence (mostly for drawing), REMEMBER TO RELEASE IT!
  */
 PREDICATE(clone_seq, 2) {
-    char *p1;
-    if (!(p1 = (char*) A1))
-        return FALSE;
-    const string add_seq(p1); // address
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);    
+    ImgSeq *seq = term2seq(A1);
     // copy image sequence
-    vector<Mat> *newseq = new vector<Mat>();
-    for (auto it = seq->begin(); it != seq->end(); ++it) {
-        newseq->push_back(((Mat) *it).clone());
-    }
-    string add = ptr2str(newseq);
-    A2 = PlTerm(add.c_str());
-    // assert size_2d and size_3d
-    int col = (*seq)[0].cols;
-    int row = (*seq)[0].rows;
-    int dur = seq->size();
-    PlTermv size_2d(3);
-    PlTermv size_3d(4);
-    size_2d[0] = A2;
-    size_2d[1] = col;
-    size_2d[2] = row;
-    size_3d[0] = A2;
-    size_3d[1] = col;
-    size_3d[2] = row;
-    size_3d[3] = dur;
-    PlTermv size_2d_atom(1);
-    size_2d_atom[0] = PlCompound("size_2d", size_2d);
-    PlTermv size_3d_atom(1);
-    size_3d_atom[0] = PlCompound("size_3d", size_3d);        
-    PlCall("assertz", size_2d_atom);
-    PlCall("assertz", size_3d_atom);
-    return TRUE;
+    Mat first = seq->frame(0);
+    Volume *newseq = new Volume(seq->width(), seq->height(), seq->depth(),
+                                first.type());
+    newseq->color_code = seq->color_code;
+    newseq->blur_size = seq->blur_size;
+    for (int z = 0; z < seq->depth(); z++)
+        seq->frame(z).copyTo(newseq->frames[z]);
+    return put_seq(A2, newseq, NULL, "clone_seq/2", 2);
 }
@@ -5,7 +5,10 @@
  */
 
 #include "sampler.hpp"
-#include "memread.hpp"
+#include "ellipse.hpp"
+#include "light.hpp"
+#include "stream.hpp"
+#include "handle.hpp"
 #include "errors.hpp"
 #include "utils.hpp"
 
@@ -15,17 +18,62 @@
 #include <SWI-cpp.h>
 #include <SWI-Prolog.h>
 
+// whether a term is a packed buffer
+bool is_buffer(PlTerm t) {
+    return handle_kind(t) == KIND_BUF;
+}
+
+/* unify t with a new handle of a packed buffer */
+int put_buffer(PlTerm t, PackedBuffer *buf) {
+    Resource *res = new Resource(KIND_BUF, buf);
+    // the resource is freed by atom garbage collection if unifying fails
+    return unify_handle(t, res);
+}
+
+/* points of a point list (converted into store) or of a point buffer,
+ * raise type_error for other buffers
+ */
+const vector<Point3i> &term2points(PlTerm t, vector<Point3i> &store) {
+    if (!is_buffer(t)) {
+        store = term2point_vec(t);
+        return store;
+    }
+    PackedBuffer *buf = term2buffer(t);
+    if (buf->type != BUF_POINTS)
+        throw PlTypeError("point buffer", t);
+    return buf->points;
+}
+
+/* numbers of a number buffer, raise type_error for other terms */
+const vector<double> &term2values(PlTerm t) {
+    PackedBuffer *buf = term2buffer(t);
+    if (buf->type != BUF_DOUBLES)
+        throw PlTypeError("number buffer", t);
+    return buf->values;
+}
+
+// unify t with values as a list, or as a new buffer if packed
+int put_values(PlTerm t, const vector<double> &values, bool packed) {
+    if (packed)
+        return put_buffer(t, new PackedBuffer(doubles_buffer(values)));
+    return t = vec2list<double>(values);
+}
+
+// unify t with colors as a list of [L, A, B], or as a new buffer if packed
+int put_colors(PlTerm t, const vector<Scalar> &colors, bool packed) {
+    if (packed)
+        return put_buffer(t, new PackedBuffer(lab_buffer(colors)));
+    return t = scalar_vec2list<double>(colors);
+}
+
 /* sample_point_var(IMGSEQ, [X, Y, Z], VAR)
  * get variation of local area of point [X, Y, Z] in image sequence IMGSEQ
  */
 PREDICATE(sample_point_var, 3) {
-    char *p1 = (char*) A1;
-    vector<int> vec = list2vec<int>(A2, 3);
-    Scalar point(vec[0], vec[1], vec[2]); // coordinates scalar
+    Point3i point = term2point(A2); // coordinates
 
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     double var = cv_imgs_point_var_loc(seq, point);
 
     // return variance
@@ -37,16 +85,12 @@ PREDICATE(sample_point_var, 3) {
  * of point [X, Y, Z] in image sequence IMGSEQ
  */
 PREDICATE(sample_point_var, 4) {
-    char *p1 = (char*) A1;
-    vector<int> vec = list2vec<int>(A2, 3);
-    Scalar point(vec[0], vec[1], vec[2]); // coordinates scalar
+    Point3i point = term2point(A2); // coordinates
     
-    vector<int> r_vec = list2vec<int>(A3, 3);
-    Scalar rad(r_vec[0], r_vec[1], r_vec[2]); // radius of local area
+    Scalar rad = term2scalar(A3); // radius of local area
 
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     double var = cv_imgs_point_var_loc(seq, point, rad);
 
     // return variance
@@ -57,13 +101,10 @@ PREDICATE(sample_point_var, 4) {
  * get scharr gradient of point [X, Y, Z] in image sequence IMGSEQ
  */
 PREDICATE(sample_point_scharr, 3) {
-    char *p1 = (char*) A1;
-    vector<int> vec = list2vec<int>(A2, 3);
-    Scalar point(vec[0], vec[1], vec[2]); // coordinates scalar
+    Point3i point = term2point(A2); // coordinates
 
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     double var = cv_imgs_point_scharr(seq, point);
 
     // return variance
@@ -74,13 +115,10 @@ PREDICATE(sample_point_scharr, 3) {
  * get LAB color of local area of point [X, Y, Z] in image sequence IMGSEQ
  */
 PREDICATE(sample_point_color, 3) {
-    char *p1 = (char*) A1;
-    vector<int> vec = list2vec<int>(A2, 3);
-    Scalar point(vec[0], vec[1], vec[2]); // coordinates scalar
+    Point3i point = term2point(A2); // coordinates
 
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     Scalar col = cv_imgs_point_color_loc(seq, point);
     vector<double> col_vec = {col[0], col[1], col[2]};
 
@@ -93,16 +131,12 @@ PREDICATE(sample_point_color, 3) {
  * local area
  */
 PREDICATE(sample_point_color, 4) {
-    char *p1 = (char*) A1;
-    vector<int> vec = list2vec<int>(A2, 3);
-    Scalar point(vec[0], vec[1], vec[2]); // coordinates scalar
+    Point3i point = term2point(A2); // coordinates
     
-    vector<int> r_vec = list2vec<int>(A3, 3);
-    Scalar rad(r_vec[0], r_vec[1], r_vec[2]); // radius of local area
+    Scalar rad = term2scalar(A3); // radius of local area
 
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     Scalar col = cv_imgs_point_color_loc(seq, point, rad);
     vector<double> col_vec = {col[0], col[1], col[2]};
 
@@ -116,20 +150,20 @@ PREDICATE(sample_point_color, 4) {
  * @DIR = [DX, DY, DZ]: direction of the line
  * @BOUND = [W, H, D]: size limit of the video (width, height and duration),
  *                     usually obained from 'size_3d(VID, W, H, D)'
- * @PTS: returned point list
+ * @PTS: returned point list, the line is followed from POINT both ways
+ *     until it leaves the video (however short DIR is); POINT itself is
+ *     always in the list, if it is outside the video, the line is only
+ *     followed on the sides whose first point is inside
  */
 PREDICATE(line_points, 4) {
-    // coordinates scalar
-    vector<int> pt_vec = list2vec<int>(A1, 3);
-    Scalar pt(pt_vec[0], pt_vec[1], pt_vec[2]);
-    // direction scalar
-    vector<int> dr_vec = list2vec<int>(A2, 3);
-    Scalar dir(dr_vec[0], dr_vec[1], dr_vec[2]);
-    // boundary scalar
-    vector<int> bd_vec = list2vec<int>(A3, 3);
-    Scalar bound(bd_vec[0], bd_vec[1], bd_vec[2]);
+    // coordinates
+    Point3i pt = term2point(A1);
+    // direction
+    Point3i dir = term2point(A2);
+    // boundary
+    Point3i bound = term2point(A3);
     // get points
-    vector<Scalar> pts = get_line_points(pt, dir, bound);
+    vector<Point3i> pts = get_line_points(pt, dir, bound);
     return A4 = point_vec2list(pts);
 }
 
@@ -142,17 +176,14 @@ PREDICATE(line_points, 4) {
  * @PTS: returned point list
  */
 PREDICATE(line_seg_points, 4) {
-    // coordinates scalar
-    vector<int> s_vec = list2vec<int>(A1, 3);
-    Scalar start(s_vec[0], s_vec[1], s_vec[2]);
-    // direction scalar
-    vector<int> e_vec = list2vec<int>(A2, 3);
-    Scalar end(e_vec[0], e_vec[1], e_vec[2]);
-    // boundary scalar
-    vector<int> bd_vec = list2vec<int>(A3, 3);
-    Scalar bound(bd_vec[0], bd_vec[1], bd_vec[2]);
+    // coordinates
+    Point3i start = term2point(A1);
+    // direction
+    Point3i end = term2point(A2);
+    // boundary
+    Point3i bound = term2point(A3);
     // get points
-    vector<Scalar> pts = get_line_seg_points(start, end, bound);
+    vector<Point3i> pts = get_line_seg_points(start, end, bound);
     return A4 = point_vec2list(pts);
 }
 
@@ -168,118 +199,688 @@ PREDICATE(line_seg_points, 4) {
  * @PTS: returned point list
  */
 PREDICATE(ellipse_points, 4) {
-    // centre coordinate scalar
-    vector<int> c_vec = list2vec<int>(A1, 3);
-    Scalar centre(c_vec[0], c_vec[1], c_vec[2]);
+    // centre coordinate
+    Point3i centre = term2point(A1);
     // parameter scalar
-    vector<int> p_vec = list2vec<int>(A2, 3);
-    Scalar param(p_vec[0], p_vec[1], p_vec[2]);
-    // boundary scalar
-    vector<int> bd_vec = list2vec<int>(A3, 3);
-    Scalar bound(bd_vec[0], bd_vec[1], bd_vec[2]);
+    Scalar param = term2scalar(A2);
+    // boundary
+    Point3i bound = term2point(A3);
     // get points
-    vector<Scalar> pts = get_ellipse_points(centre, param, bound);
+    vector<Point3i> pts = get_ellipse_points(centre, param, bound);
     return A4 = point_vec2list(pts);
 }
 
+/* line_buffer(+POINT, +DIR, +BOUND, -BUF)
+ * line_seg_buffer(+START, +END, +BOUND, -BUF)
+ * ellipse_buffer(+CENTRE, +PARAM, +BOUND, -BUF)
+ * the points of line_points/4, line_seg_points/4 and ellipse_points/4 as
+ * point buffers
+ */
+PREDICATE(line_buffer, 4) {
+    PackedBuffer *buf = new PackedBuffer(BUF_POINTS);
+    buf->points = get_line_points(term2point(A1), term2point(A2),
+                                  term2point(A3));
+    return put_buffer(A4, buf);
+}
+
+PREDICATE(line_seg_buffer, 4) {
+    PackedBuffer *buf = new PackedBuffer(BUF_POINTS);
+    buf->points = get_line_seg_points(term2point(A1), term2point(A2),
+                                      term2point(A3));
+    return put_buffer(A4, buf);
+}
+
+PREDICATE(ellipse_buffer, 4) {
+    PackedBuffer *buf = new PackedBuffer(BUF_POINTS);
+    buf->points = get_ellipse_points(term2point(A1), term2scalar(A2),
+                                     term2point(A3));
+    return put_buffer(A4, buf);
+}
+
+/* unify out with the next point (batch = 0) or list of at most batch points
+ * of a stream, leaving a choice point for the rest, points that do not unify
+ * are skipped, the stream is deleted when no choice point is left
+ */
+foreign_t yield_points(PointStream *stream, size_t batch, PlTerm out) {
+    bool found = false;
+    while (!found && !stream->done()) {
+        PlFrame fr;
+        if (batch == 0) {
+            Point3i pt = stream->next();
+            vector<long> pt_vec = {pt.x, pt.y, pt.z};
+            found = (out = vec2list<long>(pt_vec));
+        } else {
+            vector<Point3i> pts;
+            stream->take(batch, pts);
+            found = (out = point_vec2list(pts));
+        }
+        if (!found)
+            fr.rewind();
+        else if (!stream->done())
+            PL_retry_address(stream);
+    }
+    // the last answer is deterministic
+    delete stream;
+    return found;
+}
+
+/* stream of a nondeterministic point predicate: made by make() on the first
+ * call, kept by the choice point on redo, NULL when the choice point is
+ * pruned (the stream is deleted)
+ */
+template <class Make>
+PointStream *point_stream(control_t handle, Make make) {
+    switch (PL_foreign_control(handle)) {
+    case PL_FIRST_CALL:
+        return make();
+    case PL_REDO:
+        return (PointStream *) PL_foreign_context_address(handle);
+    default: // PL_PRUNED
+        delete (PointStream *) PL_foreign_context_address(handle);
+        return NULL;
+    }
+}
+
+// line stream of POINT, DIR and BOUND
+LineStream *term2line_stream(PlTerm point, PlTerm dir, PlTerm bound) {
+    return LineStream::line(term2point(point), term2point(dir),
+                            term2point(bound));
+}
+
+// segment stream of START, END and BOUND
+LineStream *term2seg_stream(PlTerm start, PlTerm end, PlTerm bound) {
+    return LineStream::segment(term2point(start), term2point(end),
+                               term2point(bound));
+}
+
+// ellipse stream of CENTRE, PARAM and BOUND
+EllipseStream *term2ellipse_stream(PlTerm centre, PlTerm param,
+                                   PlTerm bound) {
+    return new EllipseStream(term2point(centre), term2scalar(param),
+                             term2point(bound));
+}
+
+/* line_point(+POINT, +DIR, +BOUND, -PT)
+ * nondeterministic: the points of line_points/4 one by one on backtracking,
+ * in the same order; points after a cut are never generated
+ */
+PREDICATE_NONDET(line_point, 4) {
+    PlTermv _av(4, t0);
+    PointStream *stream = point_stream(handle, [&]() {
+            return term2line_stream(A1, A2, A3);
+        });
+    return stream ? yield_points(stream, 0, A4) : TRUE;
+}
+
+/* line_seg_point(+START, +END, +BOUND, -PT)
+ * nondeterministic: the points of line_seg_points/4 one by one
+ */
+PREDICATE_NONDET(line_seg_point, 4) {
+    PlTermv _av(4, t0);
+    PointStream *stream = point_stream(handle, [&]() {
+            return term2seg_stream(A1, A2, A3);
+        });
+    return stream ? yield_points(stream, 0, A4) : TRUE;
+}
+
+/* ellipse_point(+CENTRE, +PARAM, +BOUND, -PT)
+ * nondeterministic: the points of ellipse_points/4 one by one
+ */
+PREDICATE_NONDET(ellipse_point, 4) {
+    PlTermv _av(4, t0);
+    PointStream *stream = point_stream(handle, [&]() {
+            return term2ellipse_stream(A1, A2, A3);
+        });
+    return stream ? yield_points(stream, 0, A4) : TRUE;
+}
+
+/* line_points(+POINT, +DIR, +BOUND, +N, -PTS)
+ * nondeterministic: the points of line_points/4 in consecutive lists of N
+ * points (the last one may be shorter) on backtracking
+ */
+PREDICATE_NONDET(line_points, 5) {
+    PlTermv _av(5, t0);
+    long n = term2long(A4);
+    if (n < 1)
+        return LOAD_ERROR("line_points/5", 4, "N", "integer >= 1");
+    PointStream *stream = point_stream(handle, [&]() {
+            return term2line_stream(A1, A2, A3);
+        });
+    return stream ? yield_points(stream, n, A5) : TRUE;
+}
+
+/* line_seg_points(+START, +END, +BOUND, +N, -PTS)
+ * nondeterministic: the points of line_seg_points/4 in lists of N points
+ */
+PREDICATE_NONDET(line_seg_points, 5) {
+    PlTermv _av(5, t0);
+    long n = term2long(A4);
+    if (n < 1)
+        return LOAD_ERROR("line_seg_points/5", 4, "N", "integer >= 1");
+    PointStream *stream = point_stream(handle, [&]() {
+            return term2seg_stream(A1, A2, A3);
+        });
+    return stream ? yield_points(stream, n, A5) : TRUE;
+}
+
+/* ellipse_points(+CENTRE, +PARAM, +BOUND, +N, -PTS)
+ * nondeterministic: the points of ellipse_points/4 in lists of N points
+ */
+PREDICATE_NONDET(ellipse_points, 5) {
+    PlTermv _av(5, t0);
+    long n = term2long(A4);
+    if (n < 1)
+        return LOAD_ERROR("ellipse_points/5", 4, "N", "integer >= 1");
+    PointStream *stream = point_stream(handle, [&]() {
+            return term2ellipse_stream(A1, A2, A3);
+        });
+    return stream ? yield_points(stream, n, A5) : TRUE;
+}
+
 /* pts_var(+IMGSEQ, +PTS, -VARS)
  * For a list of points, return their variance
  * @IMGSEQ: input images
- * @PTS: point list, [[X1, Y1, Z1], ...]
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then VARS is
+ *     a number buffer)
  * @VARS: variances of each point, [V1, ...]
  */
 PREDICATE(pts_var, 3) {
-    // image sequence
-    char *p1 = (char*) A1;
-    const string add_seq(p1);    
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    // image sequence    
+    ImgSeq *seq = term2seq(A1);
     // point list
-    vector<Scalar> pts = point_list2vec(A2);
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
     // calculate variances
     vector<double> vars = cv_imgs_points_var_loc(seq, pts);
-    return A3 = vec2list(vars);
+    return put_values(A3, vars, is_buffer(A2));
 }
 
 /* pts_scharr(+IMGSEQ, +PTS, -VARS)
  * For a list of points, return their scharr gradients
  * @IMGSEQ: input images
- * @PTS: point list, [[X1, Y1, Z1], ...]
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then VARS is
+ *     a number buffer)
  * @GRADS: gradients of each point, [G1, ...]
  */
 PREDICATE(pts_scharr, 3) {
-    // image sequence
-    char *p1 = (char*) A1;
-    const string add_seq(p1);    
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    // image sequence    
+    ImgSeq *seq = term2seq(A1);
     // point list
-    vector<Scalar> pts = point_list2vec(A2);
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
     // calculate variances
     vector<double> vars = cv_imgs_points_scharr(seq, pts);
-    return A3 = vec2list(vars);
+    return put_values(A3, vars, is_buffer(A2));
 }
 
 
 /* pts_color(+IMGSEQ, +PTS, -COLORS)
  * For a list of points, return their color
  * @IMGSEQ: input images
- * @PTS: point list, [[X1, Y1, Z1], ...]
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then COLORS is
+ *     a Lab buffer)
  * @VARS: color of each point, [[L,A,B], ...]
  */
 PREDICATE(pts_color, 3) {
-    // image sequence
-    char *p1 = (char*) A1;
-    const string add_seq(p1);    
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    // image sequence    
+    ImgSeq *seq = term2seq(A1);
     // point list
-    vector<Scalar> pts = point_list2vec(A2);
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
     // calculate variances
     vector<Scalar> colors = cv_imgs_points_color_loc(seq, pts);
-    return A3 = scalar_vec2list<double>(colors);
+    return put_colors(A3, colors, is_buffer(A2));
 }
 
 /* pts_var_loc(+IMGSEQ, +PTS, +LOC, -VARS)
  * For a list of points, return their variance
  * @IMGSEQ: input images
- * @PTS: point list, [[X1, Y1, Z1], ...]
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then VARS is
+ *     a number buffer)
  * @LOC: local radius
  * @VARS: variances of each point, [V1, ...]
  */
 PREDICATE(pts_var_loc, 4) {
-    // image sequence
-    char *p1 = (char*) A1;
-    const string add_seq(p1);    
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    // image sequence    
+    ImgSeq *seq = term2seq(A1);
     // point list
-    vector<Scalar> pts = point_list2vec(A2);
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
     // radius
-    vector<int> r_vec = list2vec<int>(A3, 3);
-    Scalar rad(r_vec[0], r_vec[1], r_vec[2]);
+    Scalar rad = term2scalar(A3);
     cout << rad << endl;
     // calculate variances
     vector<double> vars = cv_imgs_points_var_loc(seq, pts, rad);
-    return A4 = vec2list(vars);
+    return put_values(A4, vars, is_buffer(A2));
 }
 
 /* pts_color_loc(+IMGSEQ, +PTS, +LOC, -COLORS)
  * For a list of points, return their color
  * @IMGSEQ: input images
- * @PTS: point list, [[X1, Y1, Z1], ...]
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then COLORS is
+ *     a Lab buffer)
  * @LOC: local radius (so we are getting localy averaged color...) 
  * @VARS: color of each point, [[L,A,B], ...]
  */
 PREDICATE(pts_color_loc, 4) {
-    // image sequence
-    char *p1 = (char*) A1;
-    const string add_seq(p1);    
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    // image sequence    
+    ImgSeq *seq = term2seq(A1);
     // point list
-    vector<Scalar> pts = point_list2vec(A2);
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
     // radius
-    vector<int> r_vec = list2vec<int>(A3, 3);
-    Scalar rad(r_vec[0], r_vec[1], r_vec[2]);
+    Scalar rad = term2scalar(A3);
     // calculate variances
     vector<Scalar> colors = cv_imgs_points_color_loc(seq, pts, rad);
-    return A4 = scalar_vec2list<double>(colors);
+    return put_colors(A4, colors, is_buffer(A2));
+}
+
+/* get shape of local area from prolog atom (box/ellipsoid), -1 if unknown */
+int term2shape(PlTerm t) {
+    char *p;
+    if (!PL_get_atom_chars(t.ref, &p))
+        return -1;
+    const string shape(p);
+    if (shape == "ellipsoid")
+        return LOC_ELLIPSOID;
+    else if (shape == "box")
+        return LOC_BOX;
+    else
+        return -1;
+}
+
+/* get ellipse from prolog term [[X, Y, Z], [A, B, ALPHA]] */
+void term2ellipse(PlTerm t, Point3i &centre, Scalar &param) {
+    vector<PlTerm> elems;
+    if (!get_elems(t.ref, elems, 2) || !get_point(elems[0].ref, centre) ||
+        !get_scalar(elems[1].ref, param))
+        throw PlTypeError("ellipse", t);
+}
+
+/* pts_var_loc(+IMGSEQ, +PTS, +LOC, +SHAPE, -VARS)
+ * For a list of points, return their variance
+ * @IMGSEQ: input images
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then VARS is
+ *     a number buffer)
+ * @LOC: local radius
+ * @SHAPE = <ellipsoid/box>: shape of the local area, "box" is the bounding
+ *     box of the ellipsoid, computed from (cached) integral images, so the
+ *     cost does not grow with the radius
+ * @VARS: variances of each point, [V1, ...]
+ */
+PREDICATE(pts_var_loc, 5) {
+    // image sequence
+    ImgSeq *seq = term2seq(A1);
+    // point list
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
+    // radius
+    Scalar rad = term2scalar(A3);
+    int shape = term2shape(A4);
+    if (shape < 0)
+        return LOAD_ERROR("pts_var_loc/5", 4, "SHAPE", "ellipsoid/box");
+    // calculate variances
+    vector<double> vars = cv_imgs_points_var_loc(seq, pts, rad, shape);
+    return put_values(A5, vars, is_buffer(A2));
+}
+
+/* pts_color_loc(+IMGSEQ, +PTS, +LOC, +SHAPE, -COLORS)
+ * For a list of points, return their color
+ * @IMGSEQ: input images
+ * @PTS: point list, [[X1, Y1, Z1], ...], or a point buffer (then COLORS is
+ *     a Lab buffer)
+ * @LOC: local radius
+ * @SHAPE = <ellipsoid/box>: shape of the local area, see pts_var_loc/5
+ * @COLORS: color of each point, [[L,A,B], ...]
+ */
+PREDICATE(pts_color_loc, 5) {
+    // image sequence
+    ImgSeq *seq = term2seq(A1);
+    // point list
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A2, store);
+    // radius
+    Scalar rad = term2scalar(A3);
+    int shape = term2shape(A4);
+    if (shape < 0)
+        return LOAD_ERROR("pts_color_loc/5", 4, "SHAPE", "ellipsoid/box");
+    // calculate colors
+    vector<Scalar> colors = cv_imgs_points_color_loc(seq, pts, rad, shape);
+    return put_colors(A5, colors, is_buffer(A2));
+}
+
+/* threshold condition term geq(T), gt(T), leq(T) or less(T), false if the
+ * term is none of them
+ */
+bool term2cond(PlTerm t, int &cond, double &thresh) {
+    if (t.type() != PL_TERM || t.arity() != 1)
+        return false;
+    const string name(t.name());
+    if (name == "geq")
+        cond = COND_GEQ;
+    else if (name == "gt")
+        cond = COND_GT;
+    else if (name == "leq")
+        cond = COND_LEQ;
+    else if (name == "less")
+        cond = COND_LESS;
+    else
+        return false;
+    return PL_get_float(t[1].ref, &thresh);
+}
+
+/* options of the batch samplings of lines (lines_* and segs_*)
+ * @parallel: sample different lines in parallel
+ * @buffers: return packed buffers instead of lists
+ */
+struct BatchOptions {
+    bool parallel = true;
+    bool buffers = false;
+};
+
+// options of term [parallel(BOOL), buffers(BOOL)], the others are ignored
+BatchOptions term2batch_options(PlTerm opts) {
+    BatchOptions opt;
+    vector<PlTerm> elems = term2elems(opts);
+    for (auto it = elems.begin(); it != elems.end(); ++it) {
+        PlTerm e = *it;
+        if (e.type() != PL_TERM || e.arity() != 1)
+            continue;
+        const string name(e.name());
+        if (name == "parallel")
+            opt.parallel = term2atom(e[1]) == "true";
+        else if (name == "buffers")
+            opt.buffers = term2atom(e[1]) == "true";
+    }
+    return opt;
+}
+
+/* sample the lines (or segments) of LINES in IMGSEQ and unify PTS and
+ * VALS with the points and values of every line
+ */
+int sample_lines(PlTerm imgseq, PlTerm lines, PlTerm pts, PlTerm vals,
+                 bool segs, int kind, BatchOptions opt) {
+    ImgSeq *seq = term2seq(imgseq);
+    vector<pair<Point3i, Point3i> > pairs = term2point_pair_vec(lines);
+    vector<vector<Point3i> > points;
+    vector<vector<double> > values;
+    cv_sample_lines(seq, pairs, segs, kind, opt.parallel, points, values);
+    PlTerm pt_list, val_list;
+    PlTail pt_tail(pt_list), val_tail(val_list);
+    for (size_t i = 0; i < points.size(); i++) {
+        if (opt.buffers) {
+            PackedBuffer *pt_buf = new PackedBuffer(BUF_POINTS);
+            PackedBuffer *val_buf = new PackedBuffer(
+                kind == LINE_COLOR ? BUF_LAB : BUF_DOUBLES);
+            pt_buf->points.swap(points[i]);
+            val_buf->values.swap(values[i]);
+            PlTerm pt_t, val_t;
+            put_buffer(pt_t, pt_buf);
+            put_buffer(val_t, val_buf);
+            pt_tail.append(pt_t);
+            val_tail.append(val_t);
+            continue;
+        }
+        pt_tail.append(point_vec2list(points[i]));
+        if (kind != LINE_COLOR) {
+            val_tail.append(vec2list<double>(values[i]));
+            continue;
+        }
+        vector<Scalar> colors(points[i].size());
+        for (size_t j = 0; j < colors.size(); j++)
+            colors[j] = Scalar(values[i][3 * j], values[i][3 * j + 1],
+                               values[i][3 * j + 2]);
+        val_tail.append(scalar_vec2list<double>(colors));
+    }
+    pt_tail.close();
+    val_tail.close();
+    return (pts = pt_list) && (vals = val_list);
+}
+
+/* lines_color(+IMGSEQ, +LINES, -PTS, -COLORS)
+ * sample_line_color/5 of many lines in one call, i.e. line_points/4 and
+ * pts_color/3 of every line without crossing back to prolog
+ * @LINES: [[POINT, DIR], ...], lines through POINT along DIR
+ * @PTS: point lists of the lines, [[[X1, Y1, Z1], ...], ...]
+ * @COLORS: colour lists of the lines, [[[L1, A1, B1], ...], ...]
+ */
+PREDICATE(lines_color, 4) {
+    return sample_lines(A1, A2, A3, A4, false, LINE_COLOR, BatchOptions());
+}
+
+/* lines_color(+IMGSEQ, +LINES, -PTS, -COLORS, +OPTS)
+ * lines_color/4 with options:
+ *     parallel(BOOL): sample different lines in parallel (default true)
+ *     buffers(BOOL): PTS and COLORS are lists of point and Lab buffers
+ *         (default false)
+ */
+PREDICATE(lines_color, 5) {
+    return sample_lines(A1, A2, A3, A4, false, LINE_COLOR,
+                        term2batch_options(A5));
+}
+
+/* lines_scharr(+IMGSEQ, +LINES, -PTS, -GRADS)
+ * lines_scharr(+IMGSEQ, +LINES, -PTS, -GRADS, +OPTS)
+ * as lines_color/4,5 with the Scharr gradients of the points (pts_scharr/3)
+ */
+PREDICATE(lines_scharr, 4) {
+    return sample_lines(A1, A2, A3, A4, false, LINE_SCHARR, BatchOptions());
+}
+
+PREDICATE(lines_scharr, 5) {
+    return sample_lines(A1, A2, A3, A4, false, LINE_SCHARR,
+                        term2batch_options(A5));
+}
+
+/* lines_var(+IMGSEQ, +LINES, -PTS, -VARS)
+ * lines_var(+IMGSEQ, +LINES, -PTS, -VARS, +OPTS)
+ * as lines_color/4,5 with the local variances of the points (pts_var/3)
+ */
+PREDICATE(lines_var, 4) {
+    return sample_lines(A1, A2, A3, A4, false, LINE_VAR, BatchOptions());
+}
+
+PREDICATE(lines_var, 5) {
+    return sample_lines(A1, A2, A3, A4, false, LINE_VAR,
+                        term2batch_options(A5));
+}
+
+/* segs_color(+IMGSEQ, +SEGS, -PTS, -COLORS)
+ * segs_color(+IMGSEQ, +SEGS, -PTS, -COLORS, +OPTS)
+ * segs_scharr(+IMGSEQ, +SEGS, -PTS, -GRADS)
+ * segs_scharr(+IMGSEQ, +SEGS, -PTS, -GRADS, +OPTS)
+ * segs_var(+IMGSEQ, +SEGS, -PTS, -VARS)
+ * segs_var(+IMGSEQ, +SEGS, -PTS, -VARS, +OPTS)
+ * as lines_*, with line segments (line_seg_points/4)
+ * @SEGS: [[START, END], ...]
+ */
+PREDICATE(segs_color, 4) {
+    return sample_lines(A1, A2, A3, A4, true, LINE_COLOR, BatchOptions());
+}
+
+PREDICATE(segs_color, 5) {
+    return sample_lines(A1, A2, A3, A4, true, LINE_COLOR,
+                        term2batch_options(A5));
+}
+
+PREDICATE(segs_scharr, 4) {
+    return sample_lines(A1, A2, A3, A4, true, LINE_SCHARR, BatchOptions());
+}
+
+PREDICATE(segs_scharr, 5) {
+    return sample_lines(A1, A2, A3, A4, true, LINE_SCHARR,
+                        term2batch_options(A5));
+}
+
+PREDICATE(segs_var, 4) {
+    return sample_lines(A1, A2, A3, A4, true, LINE_VAR, BatchOptions());
+}
+
+PREDICATE(segs_var, 5) {
+    return sample_lines(A1, A2, A3, A4, true, LINE_VAR,
+                        term2batch_options(A5));
+}
+
+/* pts_buffer(+PTS, -BUF)
+ * pack a point list [[X1, Y1, Z1], ...] into a point buffer, the sampling
+ * predicates taking point lists (pts_*, fit_elps, compare_hist, ...) take
+ * point buffers as well, and return buffers for them
+ */
+PREDICATE(pts_buffer, 2) {
+    vector<Point3i> pts = term2point_vec(A1);
+    return put_buffer(A2, new PackedBuffer(points_buffer(pts)));
+}
+
+/* values_buffer(+LIST, -BUF)
+ * pack a list of numbers into a number buffer, or a list of [L, A, B] into
+ * a Lab buffer
+ */
+PREDICATE(values_buffer, 2) {
+    vector<PlTerm> elems = term2elems(A1);
+    if (!elems.empty() && elems[0].type() == PL_TERM)
+        return put_buffer(A2, new PackedBuffer(
+                              lab_buffer(term2scalar_vec(A1))));
+    return put_buffer(A2, new PackedBuffer(
+                          doubles_buffer(term2vec<double>(A1))));
+}
+
+/* buffer_list(+BUF, -LIST)
+ * unpack a buffer into a list of points, numbers or [L, A, B]
+ */
+PREDICATE(buffer_list, 2) {
+    PackedBuffer *buf = term2buffer(A1);
+    if (buf->type == BUF_POINTS)
+        return A2 = point_vec2list(buf->points);
+    if (buf->type == BUF_DOUBLES)
+        return A2 = vec2list<double>(buf->values);
+    vector<Scalar> colors(buf->size());
+    for (size_t i = 0; i < colors.size(); i++)
+        colors[i] = Scalar(buf->values[3 * i], buf->values[3 * i + 1],
+                           buf->values[3 * i + 2]);
+    return A2 = scalar_vec2list<double>(colors);
+}
+
+/* buffer_size(+BUF, -N)
+ * number of items (points, numbers or colours) in a buffer
+ */
+PREDICATE(buffer_size, 2) {
+    PackedBuffer *buf = term2buffer(A1);
+    return A2 = (long) buf->size();
+}
+
+/* buffer_slice(+BUF, +START, +LEN, -SLICE)
+ * items START ... START + LEN - 1 of a buffer (index starts from 1, as
+ * nth1/3), clipped to its size
+ */
+PREDICATE(buffer_slice, 4) {
+    PackedBuffer *buf = term2buffer(A1);
+    long start = term2long(A2);
+    long len = term2long(A3);
+    if (start < 1)
+        return LOAD_ERROR("buffer_slice/4", 2, "START", "integer >= 1");
+    if (len < 0)
+        return LOAD_ERROR("buffer_slice/4", 3, "LEN", "integer >= 0");
+    return put_buffer(A4, new PackedBuffer(
+                          buffer_slice(*buf, start - 1, len)));
+}
+
+/* buffer_select(+BUF, +KEYS, +COND, -SEL)
+ * items of a buffer whose keys satisfy a condition, e.g. the points of a
+ * line whose gradients are >= 2 (as items_key_geq_T/4)
+ * @KEYS: number buffer, one key per item
+ * @COND = geq(T)/gt(T)/leq(T)/less(T): condition of the keys
+ */
+PREDICATE(buffer_select, 4) {
+    PackedBuffer *buf = term2buffer(A1);
+    const vector<double> &keys = term2values(A2);
+    int cond;
+    double thresh;
+    if (!term2cond(A3, cond, thresh))
+        return LOAD_ERROR("buffer_select/4", 3, "COND",
+                          "geq(T)/gt(T)/leq(T)/less(T)");
+    return put_buffer(A4, new PackedBuffer(
+                          buffer_select(*buf, keys, cond, thresh)));
+}
+
+/* buffer_count(+VALUES, +COND, -N)
+ * number of values of a number buffer satisfying COND (see buffer_select/4)
+ */
+PREDICATE(buffer_count, 3) {
+    const vector<double> &values = term2values(A1);
+    int cond;
+    double thresh;
+    if (!term2cond(A2, cond, thresh))
+        return LOAD_ERROR("buffer_count/3", 2, "COND",
+                          "geq(T)/gt(T)/leq(T)/less(T)");
+    return A3 = (long) buffer_count(values, cond, thresh);
+}
+
+/* buffer_argmax(+VALUES, -IDX, -MAX)
+ * index (from 1) of the first largest value of a number buffer and the
+ * value, fails if the buffer is empty
+ */
+PREDICATE(buffer_argmax, 3) {
+    const vector<double> &values = term2values(A1);
+    long idx = buffer_argmax(values);
+    if (idx < 0)
+        return FALSE;
+    return (A2 = idx + 1) && (A3 = values[idx]);
+}
+
+/* buffer_channel(+LAB, +C, -VALUES)
+ * channel C (1 = L, 2 = A, 3 = B) of a Lab buffer as a number buffer
+ */
+PREDICATE(buffer_channel, 3) {
+    PackedBuffer *buf = term2buffer(A1);
+    if (buf->type != BUF_LAB)
+        throw PlTypeError("Lab buffer", A1);
+    long c = term2long(A2);
+    if (c < 1 || c > 3)
+        return LOAD_ERROR("buffer_channel/3", 2, "C", "1/2/3");
+    return put_buffer(A3, new PackedBuffer(buffer_channel(*buf, c - 1)));
+}
+
+/* buffer_diff(+VALUES, -GRADS)
+ * gradients of a number buffer, the first one is 0 (as grad/2)
+ */
+PREDICATE(buffer_diff, 2) {
+    const vector<double> &values = term2values(A1);
+    return put_buffer(A2, new PackedBuffer(buffer_diff(values)));
+}
+
+/* release_buffer(+BUF)
+ * release a buffer explicitly (otherwise it is freed by atom garbage
+ * collection)
+ */
+PREDICATE(release_buffer, 1) {
+    release_handle(A1, KIND_BUF);
+    return TRUE;
+}
+
+/* memo key of a sampling around point (and dir) reading frames
+ * point.z - reach ... point.z + reach, params are padded with 0
+ */
+MemoKey memo_key(int kind, Point3i point, Point3i dir, int reach,
+                 initializer_list<double> params) {
+    MemoKey key;
+    key.kind = kind;
+    key.frame = point.z;
+    key.reach = reach;
+    key.point = point;
+    key.dir = dir;
+    key.params.fill(0);
+    copy(params.begin(), params.end(), key.params.begin());
+    return key;
+}
+
+// frames read around the points of a line in direction dir
+int line_reach(Point3i dir, Scalar radius) {
+    return dir.z != 0 ? MEMO_ALL_FRAMES : max((int) radius[2], 0);
+}
+
+// frames read around the points of a segment
+int seg_reach(Point3i start, Point3i end, Scalar radius) {
+    return std::abs(end.z - start.z) + max((int) radius[2], 0);
 }
 
 /* line_pts_var_geq_T(IMGSEQ, [PX, PY, PZ], [A, B, C], T_VAR, P_LIST)
@@ -292,22 +893,24 @@ PREDICATE(pts_color_loc, 4) {
  *    line
  */
 PREDICATE(line_pts_var_geq_T, 5) {
-    char *p1 = (char*) A1;
-    // coordinates scalar
-    vector<int> pt_vec = list2vec<int>(A2, 3);
-    Scalar pt(pt_vec[0], pt_vec[1], pt_vec[2]);
-    // direction scalar
-    vector<int> dr_vec = list2vec<int>(A3, 3);
-    Scalar dir(dr_vec[0], dr_vec[1], dr_vec[2]);
+    // coordinates
+    Point3i pt = term2point(A2);
+    // direction
+    Point3i dir = term2point(A3);
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // get threshold
-    double thresh = (double) A4;
+    double thresh = term2double(A4);
 
-    // sample a line and get all points that have high variance
-    vector<Scalar> points = cv_line_pts_var_geq_T(seq, pt, dir, thresh);
-    return A5 = point_vec2list(points);
+    // sample a line and get all points that have high variance (memoized)
+    Scalar rad(5, 5, 0);
+    MemoKey key = memo_key(MEMO_LINE_VAR, pt, dir, line_reach(dir, rad),
+                           {thresh, rad[0], rad[1], rad[2]});
+    shared_ptr<const vector<Point3i> > points =
+        seq->memo.get<vector<Point3i> >(key, [&]() {
+                return cv_line_pts_var_geq_T(seq, pt, dir, thresh, rad);
+            });
+    return A5 = point_vec2list(*points);
 }
 
 /* line_seg_pts_var_geq_T(IMGSEQ, [SX, SY, SZ], [EX, EY, EZ], T_VAR, P_LIST)
@@ -320,22 +923,24 @@ PREDICATE(line_pts_var_geq_T, 5) {
  *    line
  */
 PREDICATE(line_seg_pts_var_geq_T, 5) {
-    char *p1 = (char*) A1;
     // start point scalar
-    vector<int> st_vec = list2vec<int>(A2, 3);
-    Scalar st(st_vec[0], st_vec[1], st_vec[2]);
+    Point3i st = term2point(A2);
     // end point scalar
-    vector<int> ed_vec = list2vec<int>(A3, 3);
-    Scalar ed(ed_vec[0], ed_vec[1], ed_vec[2]);
+    Point3i ed = term2point(A3);
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // get threshold
-    double thresh = (double) A4;
+    double thresh = term2double(A4);
     
-    // sample a line and get all points that have high variance
-    vector<Scalar> points = cv_line_seg_pts_var_geq_T(seq, st, ed, thresh);
-    return A5 = point_vec2list(points);
+    // sample a line and get all points that have high variance (memoized)
+    Scalar rad(5, 5, 0);
+    MemoKey key = memo_key(MEMO_LINE_SEG_VAR, st, ed, seg_reach(st, ed, rad),
+                           {thresh, rad[0], rad[1], rad[2]});
+    shared_ptr<const vector<Point3i> > points =
+        seq->memo.get<vector<Point3i> >(key, [&]() {
+                return cv_line_seg_pts_var_geq_T(seq, st, ed, thresh, rad);
+            });
+    return A5 = point_vec2list(*points);
 }
 
 /* line_pts_var_geq_T(IMGSEQ, [PX, PY, PZ], [A, B, C], [RX, RY, RZ],
@@ -350,24 +955,24 @@ PREDICATE(line_seg_pts_var_geq_T, 5) {
  *    line
  */
 PREDICATE(line_pts_var_geq_T, 6) {
-    char *p1 = (char*) A1;
-    // coordinates scalar
-    vector<int> pt_vec = list2vec<int>(A2, 3);
-    Scalar pt(pt_vec[0], pt_vec[1], pt_vec[2]);
-    // direction scalar
-    vector<int> dr_vec = list2vec<int>(A3, 3);
-    Scalar dir(dr_vec[0], dr_vec[1], dr_vec[2]);
+    // coordinates
+    Point3i pt = term2point(A2);
+    // direction
+    Point3i dir = term2point(A3);
     // radius scalar
-    vector<int> r_vec = list2vec<int>(A4, 3);
-    Scalar rad(r_vec[0], r_vec[1], r_vec[2]);
+    Scalar rad = term2scalar(A4);
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // get threshold
-    double thresh = (double) A5;
-    // sample a line and get all points that have high variance
-    vector<Scalar> points = cv_line_pts_var_geq_T(seq, pt, dir, thresh, rad);
-    return A6 = point_vec2list(points);
+    double thresh = term2double(A5);
+    // sample a line and get all points that have high variance (memoized)
+    MemoKey key = memo_key(MEMO_LINE_VAR, pt, dir, line_reach(dir, rad),
+                           {thresh, rad[0], rad[1], rad[2]});
+    shared_ptr<const vector<Point3i> > points =
+        seq->memo.get<vector<Point3i> >(key, [&]() {
+                return cv_line_pts_var_geq_T(seq, pt, dir, thresh, rad);
+            });
+    return A6 = point_vec2list(*points);
 }
 
 /* line_seg_pts_var_geq_T(IMGSEQ, [PX, PY, PZ], [A, B, C],
@@ -382,24 +987,24 @@ PREDICATE(line_pts_var_geq_T, 6) {
  *    line
  */
 PREDICATE(line_seg_pts_var_geq_T, 6) {
-    char *p1 = (char*) A1;
     // start point scalar
-    vector<int> st_vec = list2vec<int>(A2, 3);
-    Scalar st(st_vec[0], st_vec[1], st_vec[2]);
+    Point3i st = term2point(A2);
     // end point scalar
-    vector<int> ed_vec = list2vec<int>(A3, 3);
-    Scalar ed(ed_vec[0], ed_vec[1], ed_vec[2]);
+    Point3i ed = term2point(A3);
     // radius scalar
-    vector<int> r_vec = list2vec<int>(A4, 3);
-    Scalar rad(r_vec[0], r_vec[1], r_vec[2]);
+    Scalar rad = term2scalar(A4);
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // get threshold
-    double thresh = (double) A5;
-    // sample a line and get all points that have high variance
-    vector<Scalar> points = cv_line_seg_pts_var_geq_T(seq, st, ed, thresh, rad);
-    return A6 = point_vec2list(points);
+    double thresh = term2double(A5);
+    // sample a line and get all points that have high variance (memoized)
+    MemoKey key = memo_key(MEMO_LINE_SEG_VAR, st, ed, seg_reach(st, ed, rad),
+                           {thresh, rad[0], rad[1], rad[2]});
+    shared_ptr<const vector<Point3i> > points =
+        seq->memo.get<vector<Point3i> >(key, [&]() {
+                return cv_line_seg_pts_var_geq_T(seq, st, ed, thresh, rad);
+            });
+    return A6 = point_vec2list(*points);
 }
 
 /* line_pts_scharr_geq_T(IMGSEQ, [PX, PY, PZ], [A, B, C], T_SCHARR, P_LIST)
@@ -412,22 +1017,23 @@ PREDICATE(line_seg_pts_var_geq_T, 6) {
  *    line
  */
 PREDICATE(line_pts_scharr_geq_T, 5) {
-    char *p1 = (char*) A1;
-    // coordinates scalar
-    vector<int> pt_vec = list2vec<int>(A2, 3);
-    Scalar pt(pt_vec[0], pt_vec[1], pt_vec[2]);
-    // direction scalar
-    vector<int> dr_vec = list2vec<int>(A3, 3);
-    Scalar dir(dr_vec[0], dr_vec[1], dr_vec[2]);
+    // coordinates
+    Point3i pt = term2point(A2);
+    // direction
+    Point3i dir = term2point(A3);
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // get threshold
-    double thresh = (double) A4;
+    double thresh = term2double(A4);
 
-    // sample a line and get all points that have high variance
-    vector<Scalar> points = cv_line_pts_scharr_geq_T(seq, pt, dir, thresh);
-    return A5 = point_vec2list(points);
+    // sample a line and get all points that have high gradient (memoized)
+    MemoKey key = memo_key(MEMO_LINE_SCHARR, pt, dir,
+                           line_reach(dir, Scalar(0, 0, 0)), {thresh});
+    shared_ptr<const vector<Point3i> > points =
+        seq->memo.get<vector<Point3i> >(key, [&]() {
+                return cv_line_pts_scharr_geq_T(seq, pt, dir, thresh);
+            });
+    return A5 = point_vec2list(*points);
 }
 
 /* line_seg_pts_scharr_geq_T(IMGSEQ, [SX, SY, SZ], [EX, EY, EZ], T_SCHARR, P_LIST)
@@ -440,53 +1046,57 @@ PREDICATE(line_pts_scharr_geq_T, 5) {
  *    line
  */
 PREDICATE(line_seg_pts_scharr_geq_T, 5) {
-    char *p1 = (char*) A1;
     // start point scalar
-    vector<int> st_vec = list2vec<int>(A2, 3);
-    Scalar st(st_vec[0], st_vec[1], st_vec[2]);
+    Point3i st = term2point(A2);
     // end point scalar
-    vector<int> ed_vec = list2vec<int>(A3, 3);
-    Scalar ed(ed_vec[0], ed_vec[1], ed_vec[2]);
+    Point3i ed = term2point(A3);
     // get image sequence and compute variance
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // get threshold
-    double thresh = (double) A4;
+    double thresh = term2double(A4);
     
-    // sample a line and get all points that have high variance
-    vector<Scalar> points = cv_line_seg_pts_scharr_geq_T(seq, st, ed, thresh);
-    return A5 = point_vec2list(points);
+    // sample a line and get all points that have high gradient (memoized)
+    MemoKey key = memo_key(MEMO_LINE_SEG_SCHARR, st, ed,
+                           seg_reach(st, ed, Scalar(0, 0, 0)), {thresh});
+    shared_ptr<const vector<Point3i> > points =
+        seq->memo.get<vector<Point3i> >(key, [&]() {
+                return cv_line_seg_pts_scharr_geq_T(seq, st, ed, thresh);
+            });
+    return A5 = point_vec2list(*points);
 }
 
 
 /* fit_elps(PTS, CENTRE, PARAM)
  * given a list (>=5) of points, fit an ellipse on a plane (the 3rd dimenstion
  * is fixed)
- * @PTS: points list 
+ * @PTS: points list (or a point buffer)
  * @CENTRE = [X, Y, _]: centre point of the ellipse
  * @PARAM = [A, B, ALPHA]: axis length (A >= B) and tilt angle (ALPHA)
  *      of the ellipse.
  * !!The unit of angle is DEG, not RAD; smaller than 1 then random angle!!
  */
 PREDICATE(fit_elps, 3) {
-    vector<Scalar> pts = point_list2vec(A1);
+    vector<Point3i> store;
+    const vector<Point3i> &pts = term2points(A1, store);
+    if (pts.size() < 5)
+        return LOAD_ERROR("fit_elps/3", 1, "PTS", ">= 5 points");
     // check if all points are on the same frame
-    int frame = pts[0][2];
+    int frame = pts[0].z;
     for (auto it = pts.begin(); it != pts.end(); ++it) {
-        Scalar pt = *it;
-        if (frame != pt[2]) {
+        if (frame != it->z) {
             cout << "[ERROR] Points are not on the same frame!" << endl;
             return FALSE;
         }
     }
     // fit ellipse
-    Scalar cen;
+    Point3i cen;
     Scalar param;
-    fit_ellipse(pts, cen, param);
+    if (!fit_ellipse(pts, cen, param))
+        return FALSE;
     // bind variables
-    vector<long> cen_vec = {(long) cen[0],
-                            (long) cen[1],
-                            (long) cen[2]};
+    vector<long> cen_vec = {(long) cen.x,
+                            (long) cen.y,
+                            (long) cen.z};
     vector<long> param_vec = {(long) param[0],
                               (long) param[1],
                               (long) param[2]};
@@ -495,22 +1105,369 @@ PREDICATE(fit_elps, 3) {
     return TRUE;
 }
 
+/* fit_elps_batch(+PTS_SETS, -CENTRES, -PARAMS)
+ * fit_elps/3 on every point list in PTS_SETS in one call (in parallel)
+ * @CENTRES, @PARAMS: lists of [X, Y, Z] and [A, B, ALPHA] in the order of
+ *     PTS_SETS, both are [] for sets that do not determine an ellipse or
+ *     whose points are not on the same frame
+ */
+PREDICATE(fit_elps_batch, 3) {
+    vector<PlTerm> elems = term2elems(A1);
+    vector<vector<Point3i> > sets;
+    for (auto it = elems.begin(); it != elems.end(); ++it)
+        sets.push_back(term2point_vec(*it));
+    vector<Point3i> cens;
+    vector<Scalar> params;
+    vector<char> fitted = fit_ellipses(sets, cens, params);
+    PlTerm cen_list, param_list;
+    PlTail cen_tail(cen_list), param_tail(param_list);
+    for (size_t i = 0; i < sets.size(); i++) {
+        bool ok = fitted[i];
+        for (auto it = sets[i].begin(); ok && it != sets[i].end(); ++it)
+            ok = it->z == sets[i][0].z;
+        vector<long> cen_vec, param_vec;
+        if (ok) {
+            cen_vec = {(long) cens[i].x, (long) cens[i].y, (long) cens[i].z};
+            param_vec = {(long) params[i][0], (long) params[i][1],
+                         (long) params[i][2]};
+        }
+        cen_tail.append(vec2list<long>(cen_vec));
+        param_tail.append(vec2list<long>(param_vec));
+    }
+    cen_tail.close();
+    param_tail.close();
+    return (A2 = cen_list) && (A3 = param_list);
+}
+
+/* ellipse_support(+IMGSEQ, +ELPS, +GRAD_T, -COUNTS, -RATIO)
+ * count the points on an ellipse whose Scharr gradients are >= GRAD_T,
+ * i.e. ellipse_points/4, pts_scharr/3 and thresholding without the lists
+ * @ELPS = [[X, Y, F], [A, B, ALPHA]]: ellipse on frame F (see
+ *     ellipse_points/4)
+ * @COUNTS = [N_POS, TOTAL]: number of supporting points and of the points
+ *     of the ellipse in the canvas
+ * @RATIO: N_POS / TOTAL (0 if TOTAL = 0)
+ */
+PREDICATE(ellipse_support, 5) {
+    ImgSeq *seq = term2seq(A1);
+    Point3i centre;
+    Scalar param;
+    term2ellipse(A2, centre, param);
+    EllipseHyp hyp = cv_ellipse_support(seq, centre, param, term2double(A3));
+    vector<long> counts = {hyp.support, hyp.total};
+    return (A4 = vec2list<long>(counts)) && (A5 = hyp.ratio);
+}
+
+/* ellipse_support(+IMGSEQ, +ELPS, +GRAD_T, -COUNTS, -RATIO, -POS)
+ * same as ellipse_support/5, POS is the list of supporting points
+ */
+PREDICATE(ellipse_support, 6) {
+    ImgSeq *seq = term2seq(A1);
+    Point3i centre;
+    Scalar param;
+    term2ellipse(A2, centre, param);
+    vector<Point3i> pos;
+    EllipseHyp hyp = cv_ellipse_support(seq, centre, param, term2double(A3),
+                                        &pos);
+    vector<long> counts = {hyp.support, hyp.total};
+    return (A4 = vec2list<long>(counts)) && (A5 = hyp.ratio) &&
+        (A6 = point_vec2list(pos));
+}
+
 /* compare_hist(+IMGSEQ, +PTS_1, +PTS_2, -DIST)
  * compare color histograms of two sets of points to decide whether
  * their distribution is identical.
- * @PTS_1/2: two set of point positions
+ * @PTS_1/2: two set of point positions (lists or point buffers)
  * @DIST: distance of histograms (quadratic mean of KL divergence
  *        in 3 channels).
  */
 PREDICATE(compare_hist, 4) {
     // image sequence    
-    char *p1 = (char*) A1;
-    const string add_seq(p1);
-    vector<Mat> *seq = str2ptr<vector<Mat>>(add_seq);
+    ImgSeq *seq = term2seq(A1);
     // point lists
-    vector<Scalar> pts_1 = point_list2vec(A2);
-    vector<Scalar> pts_2 = point_list2vec(A3);
+    vector<Point3i> store_1, store_2;
+    const vector<Point3i> &pts_1 = term2points(A2, store_1);
+    const vector<Point3i> &pts_2 = term2points(A3, store_2);
     // calculate histogram difference
     double d = compare_hist(seq, pts_1, pts_2);
     return A4 = d;
 }
+
+/* colour histogram of a region term: a list of points (or a point buffer),
+ * rect([X, Y, Z], [W, H]) (top-left corner and size), or spans(Z, [[Y, X0,
+ * X1], ...]) (rows Y from X0 to X1, inclusive)
+ */
+void term2hist(ImgSeq *seq, PlTerm t, ColorHist &hist) {
+    const string name(t.type() == PL_TERM ? t.name() : "");
+    if (name == "rect" && t.arity() == 2) {
+        Point3i pt = term2point(t[1]);
+        vector<int> size = term2vec<int>(t[2], 2);
+        hist_add_rect(seq, pt.z, Rect(pt.x, pt.y, size[0], size[1]), hist);
+    } else if (name == "spans" && t.arity() == 2) {
+        int z = term2int(t[1]);
+        vector<PlTerm> spans = term2elems(t[2]);
+        for (auto it = spans.begin(); it != spans.end(); ++it) {
+            vector<int> span = term2vec<int>(*it, 3);
+            hist_add_rect(seq, z, Rect(span[1], span[0],
+                                       span[2] - span[1] + 1, 1), hist);
+        }
+    } else {
+        vector<Point3i> store;
+        hist_add_points(seq, term2points(t, store), hist);
+    }
+}
+
+/* compare_hist_many(+IMGSEQ, +REGION, +REGIONS, -DISTS)
+ * compare the colour histogram of REGION with those of every region in
+ * REGIONS, the histogram of REGION is computed once
+ * @REGION, @REGIONS: regions are point lists, rect([X, Y, Z], [W, H])
+ *     (top-left corner and size) or spans(Z, [[Y, X0, X1], ...]) (rows of
+ *     frame Z), rectangles and spans are counted from cached integral
+ *     histograms
+ * @DISTS: distances as compare_hist/4, in the order of REGIONS
+ */
+PREDICATE(compare_hist_many, 4) {
+    ImgSeq *seq = term2seq(A1);
+    ColorHist hist;
+    term2hist(seq, A2, hist);
+    vector<PlTerm> regions = term2elems(A3);
+    vector<double> dists;
+    for (auto it = regions.begin(); it != regions.end(); ++it) {
+        ColorHist other;
+        term2hist(seq, *it, other);
+        dists.push_back(hist_distance(hist, other));
+    }
+    return A4 = vec2list<double>(dists);
+}
+
+/* best_radial_dirs(+IMGSEQ, +POINT, +ANGLES, +THRESH, +K, -PRP_DIRS)
+ * sample the lines crossing POINT radially and return the directions with
+ * the most brightness increases along them, i.e. best_dirs/4 of light
+ * source abduction computed in one call
+ * @POINT = [X, Y, Z]: the point that all lines cross
+ * @ANGLES = [START, END, STEP]: angles (DEG) in [START, END] that are
+ *     multiples of STEP
+ * @THRESH = [POS_T, NEG_T, MIN_CHANGED]: brightness gradients >= POS_T are
+ *     grad+, < NEG_T are grad-, lines with no more than MIN_CHANGED of them
+ *     get ratio -1
+ * @K: number of returned directions
+ * @PRP_DIRS: [RATIO-[POINT, DIR], ...] in decreasing order of
+ *     RATIO = #grad+/(#grad+ + #grad-), DIR is the same as angle2dir_2d/2
+ */
+PREDICATE(best_radial_dirs, 6) {
+    ImgSeq *seq = term2seq(A1);
+    Point3i pt = term2point(A2);
+    vector<int> ang_vec = term2vec<int>(A3, 3);
+    if (ang_vec[2] < 1)
+        return LOAD_ERROR("best_radial_dirs/6", 3, "ANGLES",
+                          "[START, END, STEP >= 1]");
+    vector<double> th_vec = term2vec<double>(A4, 3);
+    long k = term2long(A5);
+    if (k < 0)
+        return LOAD_ERROR("best_radial_dirs/6", 5, "K", "integer >= 0");
+    // directions are memoized, radial lines stay in the frame of the point
+    MemoKey key = memo_key(MEMO_RADIAL_DIRS, pt, Point3i(0, 0, 0), 0,
+                           {(double) ang_vec[0], (double) ang_vec[1],
+                            (double) ang_vec[2], th_vec[0], th_vec[1],
+                            (double) (int) th_vec[2], (double) k});
+    shared_ptr<const vector<RadialDir> > dirs =
+        seq->memo.get<vector<RadialDir> >(key, [&]() {
+                return cv_best_radial_dirs(seq, pt, ang_vec[0], ang_vec[1],
+                                           ang_vec[2], th_vec[0], th_vec[1],
+                                           (int) th_vec[2], k);
+            });
+    // Ratio-[Point, Dir] pairs
+    PlTerm re;
+    PlTail tail(re);
+    for (auto it = dirs->begin(); it != dirs->end(); ++it) {
+        vector<Point3i> ray = {pt, it->dir};
+        tail.append(PlCompound("-", PlTermv(PlTerm(it->ratio),
+                                            point_vec2list(ray))));
+    }
+    tail.close();
+    return A6 = re;
+}
+
+/* options of ransac_ellipses/4 from a list of iterations(N), top(K),
+ * grad(T), seed(S), axes(MIN, MAX) and rays(N), unknown items are ignored
+ */
+RansacOptions term2ransac_options(PlTerm opts) {
+    RansacOptions opt;
+    vector<PlTerm> elems = term2elems(opts);
+    for (auto it = elems.begin(); it != elems.end(); ++it) {
+        PlTerm e = *it;
+        if (e.type() != PL_TERM)
+            continue;
+        const string name(e.name());
+        if (e.arity() == 1) {
+            if (name == "iterations")
+                opt.iterations = term2long(e[1]);
+            else if (name == "top")
+                opt.top_k = term2long(e[1]);
+            else if (name == "grad")
+                opt.grad_T = term2double(e[1]);
+            else if (name == "seed")
+                opt.seed = (unsigned long) term2long(e[1]);
+            else if (name == "rays")
+                opt.rays = term2int(e[1]);
+        } else if (e.arity() == 2 && name == "axes") {
+            opt.min_axis = term2double(e[1]);
+            opt.max_axis = term2double(e[2]);
+        }
+    }
+    return opt;
+}
+
+/* ransac_ellipses(+IMGSEQ, +EDGES, +OPTS, -ELPS)
+ * detect ellipses in edge points with RANSAC: ellipses are fitted to
+ * random 5-point subsets and scored by the gradients on their contours
+ * @EDGES: list of edge points on one frame, or radial([X, Y, Z]) to sample
+ *     the edges on the lines crossing [X, Y, Z]
+ * @OPTS: list of options (defaults in brackets): iterations(N) (500)
+ *     hypotheses, top(K) (5) results, grad(T) (5.0) gradient threshold,
+ *     seed(S) (0) of the random generator, axes(MIN, MAX) (3, -1 = no
+ *     limit) of the axis lengths, rays(N) (36) radial lines
+ * @ELPS: [RATIO-[[X, Y, Z], [A, B, ALPHA]], ...] in decreasing order of
+ *     RATIO = #supporting contour points / #contour points
+ */
+PREDICATE(ransac_ellipses, 4) {
+    ImgSeq *seq = term2seq(A1);
+    RansacOptions opt = term2ransac_options(A3);
+    vector<Point3i> edges;
+    if (A2.type() == PL_TERM && string(A2.name()) == "radial" &&
+        A2.arity() == 1) {
+        edges = cv_radial_edge_points(seq, term2point(A2[1]), opt.rays,
+                                      opt.grad_T);
+    } else {
+        vector<Point3i> store;
+        edges = term2points(A2, store);
+        for (auto it = edges.begin(); it != edges.end(); ++it)
+            if (it->z != edges[0].z)
+                return LOAD_ERROR("ransac_ellipses/4", 2, "EDGES",
+                                  "points on one frame");
+    }
+    vector<EllipseHyp> elps = cv_ransac_ellipses(seq, edges, opt);
+    PlTerm re;
+    PlTail tail(re);
+    for (auto it = elps.begin(); it != elps.end(); ++it) {
+        vector<long> cen_vec = {(long) it->centre.x,
+                                (long) it->centre.y,
+                                (long) it->centre.z};
+        vector<long> param_vec = {(long) it->param[0],
+                                  (long) it->param[1],
+                                  (long) it->param[2]};
+        PlTerm elp;
+        PlTail elp_tail(elp);
+        elp_tail.append(vec2list<long>(cen_vec));
+        elp_tail.append(vec2list<long>(param_vec));
+        elp_tail.close();
+        tail.append(PlCompound("-", PlTermv(PlTerm(it->ratio), elp)));
+    }
+    tail.close();
+    return A4 = re;
+}
+
+/* options of light_source_votes/4 from a list of points(N), step(S),
+ * best(P), grad(POS_T, NEG_T, MIN_CHANGED), cell(C), top(K) and seed(S),
+ * unknown items are ignored
+ */
+LightOptions term2light_options(PlTerm opts) {
+    LightOptions opt;
+    vector<PlTerm> elems = term2elems(opts);
+    for (auto it = elems.begin(); it != elems.end(); ++it) {
+        PlTerm e = *it;
+        if (e.type() != PL_TERM)
+            continue;
+        const string name(e.name());
+        if (e.arity() == 1) {
+            if (name == "points")
+                opt.points = term2long(e[1]);
+            else if (name == "step")
+                opt.step = term2int(e[1]);
+            else if (name == "best")
+                opt.best = term2double(e[1]);
+            else if (name == "cell")
+                opt.cell = term2int(e[1]);
+            else if (name == "top")
+                opt.top_k = term2long(e[1]);
+            else if (name == "seed")
+                opt.seed = (unsigned long) term2long(e[1]);
+        } else if (e.arity() == 3 && name == "grad") {
+            opt.pos_T = term2double(e[1]);
+            opt.neg_T = term2double(e[2]);
+            opt.min_changed = term2int(e[3]);
+        }
+    }
+    return opt;
+}
+
+/* light_source_votes(+IMGSEQ, +FRAME, +OPTS, -SOURCES)
+ * abduce light sources of frame FRAME by voting: the rays of the best
+ * radial directions (best_radial_dirs/6) of random points are intersected
+ * pairwise as ray_source_intsct/3, the intersections vote in a grid and
+ * the best cells are refined with mean-shift
+ * @OPTS: list of options (defaults in brackets): points(N) (50) sampled
+ *     points, step(S) (30) and best(P) (0.5) of the radial directions,
+ *     grad(POS_T, NEG_T, MIN_CHANGED) (2, -1, 20) thresholds of
+ *     best_radial_dirs/6, cell(C) (16) size of the voting cells, top(K) (5)
+ *     results, seed(S) (0) of the random generator
+ * @SOURCES: [VOTES-[X, Y, FRAME], ...] in decreasing order of VOTES
+ */
+PREDICATE(light_source_votes, 4) {
+    ImgSeq *seq = term2seq(A1);
+    int frame = term2int(A2);
+    if (frame < 0 || frame >= seq->depth())
+        return LOAD_ERROR("light_source_votes/4", 2, "FRAME",
+                          "frame of IMGSEQ");
+    LightOptions opt = term2light_options(A3);
+    vector<LightRay> rays = cv_light_rays(seq, frame, opt);
+    vector<LightSource> srcs = cv_vote_light_sources(rays, seq->bound(), opt);
+    PlTerm re;
+    PlTail tail(re);
+    for (auto it = srcs.begin(); it != srcs.end(); ++it) {
+        vector<long> pos = {(long) it->pos.x, (long) it->pos.y,
+                            (long) it->pos.z};
+        tail.append(PlCompound("-", PlTermv(PlTerm(it->votes),
+                                            vec2list<long>(pos))));
+    }
+    tail.close();
+    return A4 = re;
+}
+
+/* sampler_threads(?N)
+ * get or set the number of threads sampling large point lists (pts_* and
+ * the predicates built on them), N = 0 means the number of cores
+ * (default), N = 1 samples serially
+ */
+PREDICATE(sampler_threads, 1) {
+    if (A1.type() == PL_VARIABLE)
+        return A1 = (long) pool_threads();
+    long n = term2long(A1);
+    if (n < 0)
+        return LOAD_ERROR("sampler_threads/1", 1, "N", "integer >= 0");
+    set_pool_threads(n);
+    return TRUE;
+}
+
+/* sampler_memo(+IMGSEQ, -[HITS, MISSES, ENTRIES])
+ * statistics of the memoized samplings (line_*_geq_T and best_radial_dirs)
+ * of an image sequence, results are dropped with the frames drawn on and
+ * with the sequence (release_imgseq/1)
+ * @HITS, @MISSES: number of samplings answered from / added to the memo
+ * @ENTRIES: number of memoized results
+ */
+PREDICATE(sampler_memo, 2) {
+    ImgSeq *seq = term2seq(A1);
+    vector<long> stats = {seq->memo.hits.load(), seq->memo.misses.load(),
+                          (long) seq->memo.size()};
+    return A2 = vec2list<long>(stats);
+}
+
+/* sampler_memo_clear(+IMGSEQ)
+ * drop the memoized samplings of an image sequence and reset the counters
+ */
+PREDICATE(sampler_memo_clear, 1) {
+    ImgSeq *seq = term2seq(A1);
+    seq->memo.clear();
+    return TRUE;
+}
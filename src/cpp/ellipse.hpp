@@ -0,0 +1,230 @@
+/* Ellipse detection
+ *     RANSAC on edge points: ellipses are fitted to random minimal subsets
+ *     (5 points) of the edges and scored by the gradients on their contours.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _ELLIPSE_HPP
+#define _ELLIPSE_HPP
+
+#include "sampler.hpp"
+#include "contour.hpp"
+#include "imgseq.hpp"
+#include "pool.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// hypotheses are fitted and scored in parallel in chunks of this size
+#define RANSAC_CHUNK 4
+// ellipses whose centres and axes all differ by at most this are duplicates
+#define RANSAC_DUP_DIST 3
+
+/********** declaration **********/
+
+/* an ellipse and its support in the gradients of its frame
+ * @centre, @param: as fit_ellipse
+ * @support: number of contour points with gradient >= grad_T
+ * @total: number of contour points inside the canvas
+ * @ratio: support / total
+ */
+struct EllipseHyp {
+    Point3i centre;
+    Scalar param;
+    long support;
+    long total;
+    double ratio;
+};
+
+/* options of RANSAC ellipse detection
+ * @iterations: number of sampled minimal subsets (hypotheses)
+ * @top_k: number of returned ellipses
+ * @grad_T: Scharr gradient threshold of edges and supporting points
+ * @seed: seed of the random generator, the result only depends on it
+ * @min_axis, @max_axis: range of the axis lengths of accepted ellipses,
+ *     max_axis < 0 means no upper limit
+ * @rays: number of radial lines when edges are sampled around a point
+ */
+struct RansacOptions {
+    long iterations;
+    long top_k;
+    double grad_T;
+    unsigned long seed;
+    double min_axis;
+    double max_axis;
+    int rays;
+    RansacOptions() : iterations(500), top_k(5), grad_T(5.0), seed(0),
+                      min_axis(3), max_axis(-1), rays(36) {}
+};
+
+/* edge points on the lines crossing point in rays directions evenly
+ *     spread over 180 degrees (see cv_line_pts_scharr_geq_T)
+ */
+vector<Point3i> cv_radial_edge_points(ImgSeq *images, Point3i point,
+                                      int rays, double grad_T = 5.0);
+
+/* count the points on the contour of an ellipse whose gradients exceed
+ *     grad_T and fill support, total and ratio of hyp
+ * @mag: gradient magnitudes of the frame of the ellipse (FrameGradient)
+ * @pos: if not NULL, the supporting points are appended
+ */
+void ellipse_support(const Mat &mag, Point3i bound, double grad_T,
+                     EllipseHyp &hyp, vector<Point3i> *pos = NULL);
+/* same as above on the (cached) gradients of the frame of the centre,
+ *     total is 0 if the frame is not in the sequence
+ */
+EllipseHyp cv_ellipse_support(ImgSeq *images, Point3i centre, Scalar param,
+                              double grad_T, vector<Point3i> *pos = NULL);
+
+/* detect ellipses in edge points with RANSAC
+ * @images: image sequence
+ * @edges: edge points, all on the same frame
+ * @opt: options
+ * @return: at most opt.top_k ellipses in decreasing order of ratio,
+ *     without duplicates
+ */
+vector<EllipseHyp> cv_ransac_ellipses(ImgSeq *images,
+                                      const vector<Point3i> &edges,
+                                      RansacOptions opt = RansacOptions());
+
+/*********** implementation ************/
+vector<Point3i> cv_radial_edge_points(ImgSeq *images, Point3i point,
+                                      int rays, double grad_T) {
+    vector<Point3i> re;
+    if (out_of_canvas(point, images->bound()))
+        return re;
+    for (int i = 0; i < rays; i++) {
+        double rad = (180.0 * i / rays) * CV_PI / 180.0;
+        // same direction vectors as best radial directions
+        Point3i dir((int) round(10e6 * cos(rad)),
+                    (int) round(10e6 * sin(rad)), 0);
+        vector<Point3i> pts = cv_line_pts_scharr_geq_T(images, point, dir,
+                                                       grad_T);
+        // the first and last points are the ends of the line
+        if (pts.size() > 2)
+            re.insert(re.end(), pts.begin() + 1, pts.end() - 1);
+    }
+    return re;
+}
+
+void ellipse_support(const Mat &mag, Point3i bound, double grad_T,
+                     EllipseHyp &hyp, vector<Point3i> *pos) {
+    // contour offsets are read in place, no points are built
+    shared_ptr<const vector<Point> > contour = get_ellipse_contour(hyp.param);
+    int w = mag.cols;
+    int h = mag.rows;
+    hyp.support = 0;
+    hyp.total = 0;
+    for (auto it = contour->begin(); it != contour->end(); ++it) {
+        int x = hyp.centre.x + it->x;
+        int y = hyp.centre.y + it->y;
+        if (x < 0 || y < 0 || x >= bound.x || y >= bound.y)
+            continue;
+        hyp.total++;
+        // border gradients are 0 as in cv_imgs_point_scharr
+        if (x < 1 || y < 1 || x > w - 2 || y > h - 2)
+            continue;
+        if (mag.at<float>(y, x) >= grad_T) {
+            hyp.support++;
+            if (pos)
+                pos->push_back(Point3i(x, y, hyp.centre.z));
+        }
+    }
+    hyp.ratio = hyp.total > 0 ? (double) hyp.support / hyp.total : 0.0;
+}
+
+EllipseHyp cv_ellipse_support(ImgSeq *images, Point3i centre, Scalar param,
+                              double grad_T, vector<Point3i> *pos) {
+    EllipseHyp hyp = {centre, param, 0, 0, 0.0};
+    int frame = centre.z;
+    if (frame < 0 || frame >= images->depth())
+        return hyp;
+    shared_ptr<FrameGradient> grad =
+        images->gradients.get(frame, [&]() { return images->frame(frame); });
+    ellipse_support(grad->mag, images->bound(), grad_T, hyp, pos);
+    return hyp;
+}
+
+vector<EllipseHyp> cv_ransac_ellipses(ImgSeq *images,
+                                      const vector<Point3i> &edges,
+                                      RansacOptions opt) {
+    vector<EllipseHyp> re;
+    size_t n = edges.size();
+    if (n < 5 || opt.iterations < 1 || opt.top_k < 1)
+        return re;
+    Point3i bound = images->bound();
+    int frame = edges[0].z;
+    shared_ptr<FrameGradient> grad =
+        images->gradients.get(frame, [&]() { return images->frame(frame); });
+
+    // minimal subsets are drawn serially, so they only depend on the seed
+    mt19937 rng(opt.seed);
+    uniform_int_distribution<size_t> pick(0, n - 1);
+    vector<Point3i> subsets(5 * opt.iterations);
+    for (long i = 0; i < opt.iterations; i++) {
+        size_t idx[5];
+        for (int j = 0; j < 5; j++) {
+            bool dup;
+            do {
+                idx[j] = pick(rng);
+                dup = false;
+                for (int k = 0; k < j; k++)
+                    dup = dup || idx[k] == idx[j];
+            } while (dup);
+            subsets[5 * i + j] = edges[idx[j]];
+        }
+    }
+
+    // fit and score the hypotheses, ratio < 0 marks rejected ones
+    vector<EllipseHyp> hyps(opt.iterations);
+    shared_pool()->parallel_for(hyps.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                EllipseHyp &hyp = hyps[i];
+                hyp.ratio = -1;
+                vector<Point3i> sub(subsets.begin() + 5 * i,
+                                    subsets.begin() + 5 * (i + 1));
+                if (!fit_ellipse(sub, hyp.centre, hyp.param))
+                    continue; // degenerate subset
+                if (hyp.param[1] < opt.min_axis ||
+                    (opt.max_axis >= 0 && hyp.param[0] > opt.max_axis) ||
+                    out_of_canvas(hyp.centre, bound))
+                    continue;
+                ellipse_support(grad->mag, bound, opt.grad_T, hyp);
+            }
+        }, 2 * RANSAC_CHUNK, RANSAC_CHUNK);
+
+    // best first, ties by larger support
+    vector<EllipseHyp> valid;
+    for (auto it = hyps.begin(); it != hyps.end(); ++it)
+        if (it->ratio >= 0 && it->total > 0)
+            valid.push_back(*it);
+    stable_sort(valid.begin(), valid.end(),
+                [](const EllipseHyp &h1, const EllipseHyp &h2) {
+                    if (h1.ratio != h2.ratio)
+                        return h1.ratio > h2.ratio;
+                    return h1.support > h2.support;
+                });
+    for (auto it = valid.begin();
+         it != valid.end() && re.size() < (size_t) opt.top_k; ++it) {
+        bool dup = false;
+        for (auto jt = re.begin(); jt != re.end() && !dup; ++jt)
+            dup = abs(it->centre.x - jt->centre.x) <= RANSAC_DUP_DIST &&
+                abs(it->centre.y - jt->centre.y) <= RANSAC_DUP_DIST &&
+                fabs(it->param[0] - jt->param[0]) <= RANSAC_DUP_DIST &&
+                fabs(it->param[1] - jt->param[1]) <= RANSAC_DUP_DIST;
+        if (!dup)
+            re.push_back(*it);
+    }
+    return re;
+}
+
+#endif
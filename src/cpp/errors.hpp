@@ -6,6 +6,8 @@
 #ifndef _ERRORS_HPP
 #define _ERRORS_HPP
 
+#include "imgseq.hpp"
+
 #include <SWI-cpp.h>
 #include <SWI-Prolog.h>
 
@@ -26,4 +28,20 @@ int PUT_ERROR(string pred_name, int arg_num, string arg_name, string type) {
     return FALSE;
 }
 
+/* predicates raise frames of sequences that cannot be read (FrameError,
+ * possibly thrown by sampling workers and rethrown in the calling thread)
+ * as existence_error(frame, Z), prolog exceptions can only be made here
+ */
+#undef PREDICATE
+#define PREDICATE(name, arity)                                          \
+    static foreign_t seq_ ## name ## __ ## arity(PlTermv _av);          \
+    NAMED_PREDICATE(#name, name, arity) {                               \
+        try {                                                           \
+            return seq_ ## name ## __ ## arity(_av);                    \
+        } catch (const FrameError &e) {                                 \
+            throw PlExistenceError("frame", PlTerm((long) e.frame));    \
+        }                                                               \
+    }                                                                   \
+    static foreign_t seq_ ## name ## __ ## arity(PlTermv _av)
+
 #endif
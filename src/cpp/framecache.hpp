@@ -0,0 +1,257 @@
+/* Per-frame caches of image sequences
+ *     Data computed from whole frames (integral images, gradient maps,
+ *     histograms) on first touch of a frame and reused by the queries.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _FRAMECACHE_HPP
+#define _FRAMECACHE_HPP
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// number of frames whose integral images are kept per sequence
+#define INTEGRAL_CACHE_FRAMES 32
+// number of frames whose gradient maps are kept per sequence
+#define GRADIENT_CACHE_FRAMES 64
+// number of frames whose integral histograms are kept per sequence
+#define HISTOGRAM_CACHE_FRAMES 16
+// bins of colour histograms per channel (8 values per bin)
+#define HIST_BINS 32
+// side of the tiles of integral histograms
+#define HIST_TILE 16
+
+/********** declaration **********/
+
+/* integral images of one frame, both (H + 1) x (W + 1) with the channels
+ * of the frame
+ * @sum: sums (CV_64F, 32-bit sums overflow on large frames)
+ * @sqsum: sums of squares (CV_64F)
+ */
+struct FrameIntegral {
+    explicit FrameIntegral(const Mat &frame);
+    Mat sum;
+    Mat sqsum;
+};
+
+/* Scharr gradient magnitude of the first (L) channel of a frame
+ * @mag: H x W (CV_32F), the kernels are normalized by 1/32
+ */
+struct FrameGradient {
+    explicit FrameGradient(const Mat &frame);
+    Mat mag;
+};
+
+/* colour histogram, counts of the values / 8 of 3 channels
+ *     (missing channels of grey frames count as 0)
+ * @n: number of counted pixels
+ */
+struct ColorHist {
+    long n;
+    int freq[3][HIST_BINS];
+    ColorHist() : n(0) { memset(freq, 0, sizeof(freq)); }
+};
+
+/* integral histogram of one frame, over tiles of HIST_TILE x HIST_TILE
+ *     pixels, regions are counted from the tiles they cover and the bins
+ *     of the remaining pixels
+ * @bins: H x W (CV_8UC3), the bin of every channel of every pixel
+ * @tiles: (H / T + 1) x (W / T + 1) integral counts, 3 * HIST_BINS each
+ */
+struct FrameHistogram {
+    explicit FrameHistogram(const Mat &frame);
+    // add the pixels of rect (clipped to the frame) to hist
+    void add_rect(Rect rect, ColorHist &hist) const;
+    Mat bins;
+    int tiles_w, tiles_h;
+    vector<int> tiles;
+private:
+    void add_pixels(int y, int x0, int x1, ColorHist &hist) const;
+    const int *tile(int ty, int tx) const {
+        return &tiles[((size_t) ty * (tiles_w + 1) + tx) * 3 * HIST_BINS];
+    }
+};
+
+/* Cache of Entry (constructed from a frame) for the frames of a sequence,
+ *     the least recently used entries are dropped beyond budget.
+ * Thread safe, an entry stays valid while it is held by a reader. Entries
+ *     computed while the cache is invalidated are returned but not kept.
+ */
+template <class Entry>
+class FrameCache {
+public:
+    explicit FrameCache(size_t budget) : budget(budget), generation(0) {}
+    /* entry of frame z, get_frame() returns the frame and is only called
+     * if the entry has to be computed
+     */
+    template <class Func>
+    shared_ptr<Entry> get(int z, Func get_frame);
+    // drop frame z (all frames if z < 0), e.g. after drawing on it
+    void invalidate(int z = -1);
+private:
+    typedef pair<shared_ptr<Entry>, list<int>::iterator> Item;
+    size_t budget;
+    unsigned long generation; // number of invalidations
+    list<int> lru; // most recently used first
+    unordered_map<int, Item> cache;
+    mutex mtx;
+};
+
+/*********** implementation ************/
+FrameIntegral::FrameIntegral(const Mat &frame) {
+    integral(frame, sum, sqsum, CV_64F, CV_64F);
+}
+
+FrameGradient::FrameGradient(const Mat &frame) {
+    Mat L;
+    if (frame.channels() == 1)
+        L = frame;
+    else
+        extractChannel(frame, L, 0);
+    Mat gx, gy;
+    Scharr(L, gx, CV_32F, 1, 0, 1.0 / 32);
+    Scharr(L, gy, CV_32F, 0, 1, 1.0 / 32);
+    magnitude(gx, gy, mag);
+}
+
+FrameHistogram::FrameHistogram(const Mat &frame) {
+    int w = frame.cols, h = frame.rows, ch = frame.channels();
+    bins = Mat(h, w, CV_8UC3, Scalar(0, 0, 0));
+    for (int y = 0; y < h; y++) {
+        const uchar *src = frame.ptr<uchar>(y);
+        uchar *dst = bins.ptr<uchar>(y);
+        for (int x = 0; x < w; x++)
+            for (int c = 0; c < 3 && c < ch; c++)
+                dst[3 * x + c] = src[ch * x + c] >> 3;
+    }
+    // counts of every tile, then summed up to integral counts
+    tiles_w = w / HIST_TILE;
+    tiles_h = h / HIST_TILE;
+    const int cell = 3 * HIST_BINS;
+    tiles.assign((size_t) (tiles_h + 1) * (tiles_w + 1) * cell, 0);
+    for (int ty = 0; ty < tiles_h; ty++)
+        for (int tx = 0; tx < tiles_w; tx++) {
+            int *t = &tiles[((size_t) (ty + 1) * (tiles_w + 1) + tx + 1)
+                            * cell];
+            for (int y = ty * HIST_TILE; y < (ty + 1) * HIST_TILE; y++) {
+                const uchar *b = bins.ptr<uchar>(y) + 3 * tx * HIST_TILE;
+                for (int x = 0; x < HIST_TILE; x++, b += 3)
+                    for (int c = 0; c < 3; c++)
+                        t[c * HIST_BINS + b[c]]++;
+            }
+        }
+    for (int ty = 1; ty <= tiles_h; ty++)
+        for (int tx = 1; tx <= tiles_w; tx++) {
+            int *t = &tiles[((size_t) ty * (tiles_w + 1) + tx) * cell];
+            const int *up = t - (tiles_w + 1) * cell;
+            const int *left = t - cell;
+            const int *diag = up - cell;
+            for (int k = 0; k < cell; k++)
+                t[k] += up[k] + left[k] - diag[k];
+        }
+}
+
+void FrameHistogram::add_pixels(int y, int x0, int x1,
+                                ColorHist &hist) const {
+    const uchar *b = bins.ptr<uchar>(y) + 3 * x0;
+    for (int x = x0; x < x1; x++, b += 3)
+        for (int c = 0; c < 3; c++)
+            hist.freq[c][b[c]]++;
+    hist.n += max(x1 - x0, 0);
+}
+
+void FrameHistogram::add_rect(Rect rect, ColorHist &hist) const {
+    int x0 = max(rect.x, 0), y0 = max(rect.y, 0);
+    int x1 = min(rect.x + rect.width, bins.cols);
+    int y1 = min(rect.y + rect.height, bins.rows);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    // tiles inside the rectangle
+    int tx0 = (x0 + HIST_TILE - 1) / HIST_TILE, tx1 = x1 / HIST_TILE;
+    int ty0 = (y0 + HIST_TILE - 1) / HIST_TILE, ty1 = y1 / HIST_TILE;
+    if (tx0 >= tx1 || ty0 >= ty1) {
+        for (int y = y0; y < y1; y++)
+            add_pixels(y, x0, x1, hist);
+        return;
+    }
+    const int *a = tile(ty1, tx1), *b = tile(ty0, tx1);
+    const int *c = tile(ty1, tx0), *d = tile(ty0, tx0);
+    for (int ch = 0; ch < 3; ch++)
+        for (int k = 0; k < HIST_BINS; k++) {
+            int i = ch * HIST_BINS + k;
+            hist.freq[ch][k] += a[i] - b[i] - c[i] + d[i];
+        }
+    hist.n += (long) (tx1 - tx0) * (ty1 - ty0) * HIST_TILE * HIST_TILE;
+    // pixels around the tiles
+    int ix0 = tx0 * HIST_TILE, ix1 = tx1 * HIST_TILE;
+    int iy0 = ty0 * HIST_TILE, iy1 = ty1 * HIST_TILE;
+    for (int y = y0; y < y1; y++) {
+        if (y < iy0 || y >= iy1) {
+            add_pixels(y, x0, x1, hist);
+        } else {
+            add_pixels(y, x0, ix0, hist);
+            add_pixels(y, ix1, x1, hist);
+        }
+    }
+}
+
+template <class Entry>
+template <class Func>
+shared_ptr<Entry> FrameCache<Entry>::get(int z, Func get_frame) {
+    unsigned long gen;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = cache.find(z);
+        if (it != cache.end()) {
+            lru.splice(lru.begin(), lru, it->second.second);
+            return it->second.first;
+        }
+        gen = generation;
+    }
+    // compute unlocked, other frames can be served meanwhile
+    shared_ptr<Entry> entry = make_shared<Entry>(get_frame());
+
+    lock_guard<mutex> lock(mtx);
+    if (generation != gen) // the frame may have been drawn on meanwhile
+        return entry;
+    auto it = cache.find(z);
+    if (it != cache.end()) // computed by another thread
+        return it->second.first;
+    lru.push_front(z);
+    cache[z] = Item(entry, lru.begin());
+    while (cache.size() > budget) {
+        cache.erase(lru.back());
+        lru.pop_back();
+    }
+    return entry;
+}
+
+template <class Entry>
+void FrameCache<Entry>::invalidate(int z) {
+    lock_guard<mutex> lock(mtx);
+    generation++;
+    if (z < 0) {
+        cache.clear();
+        lru.clear();
+        return;
+    }
+    auto it = cache.find(z);
+    if (it != cache.end()) {
+        lru.erase(it->second.second);
+        cache.erase(it);
+    }
+}
+
+#endif
@@ -0,0 +1,341 @@
+/* Typed handles of images, videos, image sequences and packed buffers for
+ *     swi-prolog
+ *     Objects are passed to prolog as blobs, so lookups are O(1), the
+ *     type of a handle is checked and atom garbage collection releases
+ *     objects that are not referenced any more.
+ * ================================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+#ifndef _HANDLE_HPP
+#define _HANDLE_HPP
+
+#include "imgseq.hpp"
+#include "buffer.hpp"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio/videoio.hpp>
+#include <SWI-cpp.h>
+#include <SWI-Prolog.h>
+
+#include <cstring>
+#include <mutex>
+
+using namespace std;
+using namespace cv;
+
+// blob type names, also used as the expected type in errors
+#define HANDLE_IMG "cv_img"
+#define HANDLE_VIDEO "cv_video"
+#define HANDLE_SEQ "cv_imgseq"
+#define HANDLE_BUF "cv_buffer"
+
+enum HandleKind { KIND_IMG, KIND_VIDEO, KIND_SEQ, KIND_BUF };
+
+/********** declaration **********/
+
+/* An object owned by prolog handles
+ * The object is destroyed when nobody uses it (users == 0) and it is
+ *     either released explicitly (release_* predicates) or all its
+ *     handles are garbage collected. The resource itself is freed when
+ *     both counts drop to 0.
+ * @handles: number of blob atoms of the object itself
+ * @users: number of dependents that need the object, i.e. frame handles
+ *     of a sequence (seq_img/3) and lazy sequences borrowing a video
+ * @parent: resource this object depends on (one of its users)
+ */
+struct Resource {
+    int kind;
+    void *obj;
+    Resource *parent;
+    long handles;
+    long users;
+    bool released;
+    mutex mtx;
+
+    Resource(int kind, void *obj, Resource *parent = NULL);
+};
+
+/* content of a blob: the resource, or frame "frame" of a sequence
+ * resource (a blob of image type)
+ */
+struct HandleRef {
+    Resource *res;
+    long frame;
+};
+
+/* unify term with a (new or existing) handle of resource res, or the
+ * image handle of frame "frame" of sequence resource res
+ */
+int unify_handle(PlTerm t, Resource *res, long frame = -1);
+
+/* get objects of handles, raise type_error if the term is not a handle of
+ * the kind, existence_error if it has been released
+ */
+Mat *term2img(PlTerm t);
+VideoCapture *term2video(PlTerm t);
+ImgSeq *term2seq(PlTerm t);
+PackedBuffer *term2buffer(PlTerm t);
+Resource *term2resource(PlTerm t, int kind);
+/* kind of a live handle (frames of sequences are images), -1 if the term
+ * is not a handle or the handle has been released
+ */
+int handle_kind(PlTerm t);
+/* image IMG has been drawn on: if it is a frame of a sequence, drop what
+ * the sequence has computed from the frame
+ */
+void invalidate_img(PlTerm t);
+
+/* release the object of a handle explicitly, objects still used by other
+ * handles (e.g. frames of a sequence) are destroyed when they are unused
+ */
+void release_handle(PlTerm t, int kind);
+
+/* dependency between resources, e.g. a lazy sequence needs its video */
+void resource_use(Resource *res);
+void resource_unuse(Resource *res);
+
+/********* implementation ********/
+void handle_acquire(atom_t a);
+int handle_release(atom_t a);
+
+static PL_blob_t img_blob = {
+    PL_BLOB_MAGIC,
+    PL_BLOB_UNIQUE,
+    (char *) HANDLE_IMG,
+    handle_release,
+    NULL, // compare
+    NULL, // write
+    handle_acquire
+};
+
+static PL_blob_t video_blob = {
+    PL_BLOB_MAGIC,
+    PL_BLOB_UNIQUE,
+    (char *) HANDLE_VIDEO,
+    handle_release,
+    NULL,
+    NULL,
+    handle_acquire
+};
+
+static PL_blob_t seq_blob = {
+    PL_BLOB_MAGIC,
+    PL_BLOB_UNIQUE,
+    (char *) HANDLE_SEQ,
+    handle_release,
+    NULL,
+    NULL,
+    handle_acquire
+};
+
+static PL_blob_t buf_blob = {
+    PL_BLOB_MAGIC,
+    PL_BLOB_UNIQUE,
+    (char *) HANDLE_BUF,
+    handle_release,
+    NULL,
+    NULL,
+    handle_acquire
+};
+
+const char *kind_name(int kind) {
+    switch (kind) {
+    case KIND_IMG: return HANDLE_IMG;
+    case KIND_VIDEO: return HANDLE_VIDEO;
+    case KIND_BUF: return HANDLE_BUF;
+    default: return HANDLE_SEQ;
+    }
+}
+
+Resource::Resource(int kind, void *obj, Resource *parent)
+    : kind(kind), obj(obj), parent(parent),
+      handles(0), users(0), released(false) {
+    if (parent)
+        resource_use(parent);
+}
+
+void destroy_object(int kind, void *obj, Resource *parent) {
+    switch (kind) {
+    case KIND_IMG:
+        delete (Mat *) obj;
+        break;
+    case KIND_VIDEO:
+        ((VideoCapture *) obj)->release();
+        delete (VideoCapture *) obj;
+        break;
+    case KIND_SEQ:
+        delete (ImgSeq *) obj;
+        break;
+    case KIND_BUF:
+        delete (PackedBuffer *) obj;
+        break;
+    }
+    if (parent)
+        resource_unuse(parent);
+}
+
+/* destroy the object and free the resource as far as allowed,
+ * res->mtx is locked by the caller and unlocked here
+ */
+void resource_update(Resource *res, unique_lock<mutex> &lock) {
+    void *obj = NULL;
+    Resource *parent = NULL;
+    if (res->users == 0 && (res->released || res->handles == 0)) {
+        // detach the object while locked, so it is destroyed only once
+        obj = res->obj;
+        parent = res->parent;
+        res->obj = NULL;
+        res->parent = NULL;
+    }
+    bool free_res = res->users == 0 && res->handles == 0;
+    lock.unlock();
+    if (obj)
+        destroy_object(res->kind, obj, parent);
+    if (free_res)
+        delete res;
+}
+
+void resource_use(Resource *res) {
+    lock_guard<mutex> lock(res->mtx);
+    res->users++;
+}
+
+void resource_unuse(Resource *res) {
+    unique_lock<mutex> lock(res->mtx);
+    res->users--;
+    resource_update(res, lock);
+}
+
+HandleRef *blob_ref(atom_t a) {
+    return (HandleRef *) PL_blob_data(a, NULL, NULL);
+}
+
+void handle_acquire(atom_t a) {
+    HandleRef *ref = blob_ref(a);
+    lock_guard<mutex> lock(ref->res->mtx);
+    if (ref->frame < 0) {
+        ref->res->handles++;
+    } else {
+        ref->res->users++; // a frame handle needs its sequence
+        ((ImgSeq *) ref->res->obj)->pin_frame(ref->frame);
+    }
+}
+
+int handle_release(atom_t a) {
+    HandleRef *ref = blob_ref(a);
+    Resource *res = ref->res;
+    unique_lock<mutex> lock(res->mtx);
+    if (ref->frame < 0) {
+        res->handles--;
+    } else {
+        // the sequence is alive, this handle is one of its users
+        ((ImgSeq *) res->obj)->unpin_frame(ref->frame);
+        res->users--;
+    }
+    resource_update(res, lock);
+    return TRUE;
+}
+
+int unify_handle(PlTerm t, Resource *res, long frame) {
+    PL_blob_t *type;
+    if (frame >= 0 || res->kind == KIND_IMG)
+        type = &img_blob;
+    else if (res->kind == KIND_VIDEO)
+        type = &video_blob;
+    else if (res->kind == KIND_BUF)
+        type = &buf_blob;
+    else
+        type = &seq_blob;
+    HandleRef ref;
+    memset(&ref, 0, sizeof(ref)); // unique blobs are compared bytewise
+    ref.res = res;
+    ref.frame = frame;
+    return PL_unify_blob(t.ref, &ref, sizeof(ref), type);
+}
+
+/* get the reference of a handle of blob type "name" */
+HandleRef *term2ref(PlTerm t, const char *name) {
+    void *data;
+    size_t len;
+    PL_blob_t *type;
+    // blob types are compared by name, each library has its own copy
+    if (!PL_get_blob(t.ref, &data, &len, &type) ||
+        strcmp(type->name, name) != 0 || len != sizeof(HandleRef))
+        throw PlTypeError(name, t);
+    return (HandleRef *) data;
+}
+
+Resource *term2resource(PlTerm t, int kind) {
+    const char *name = kind_name(kind);
+    HandleRef *ref = term2ref(t, name);
+    if (ref->frame < 0 && (ref->res->released || ref->res->obj == NULL))
+        throw PlExistenceError(name, t);
+    return ref->res;
+}
+
+Mat *term2img(PlTerm t) {
+    HandleRef *ref = term2ref(t, HANDLE_IMG);
+    if (ref->frame >= 0) // frame of a sequence, kept alive by the handle
+        return ((ImgSeq *) ref->res->obj)->frame_ref(ref->frame);
+    if (ref->res->released || ref->res->obj == NULL)
+        throw PlExistenceError(HANDLE_IMG, t);
+    return (Mat *) ref->res->obj;
+}
+
+int handle_kind(PlTerm t) {
+    void *data;
+    size_t len;
+    PL_blob_t *type;
+    if (!PL_get_blob(t.ref, &data, &len, &type) || len != sizeof(HandleRef))
+        return -1;
+    int kind;
+    if (strcmp(type->name, HANDLE_IMG) == 0)
+        kind = KIND_IMG;
+    else if (strcmp(type->name, HANDLE_VIDEO) == 0)
+        kind = KIND_VIDEO;
+    else if (strcmp(type->name, HANDLE_SEQ) == 0)
+        kind = KIND_SEQ;
+    else if (strcmp(type->name, HANDLE_BUF) == 0)
+        kind = KIND_BUF;
+    else
+        return -1;
+    HandleRef *ref = (HandleRef *) data;
+    if (ref->frame < 0 && (ref->res->released || ref->res->obj == NULL))
+        return -1;
+    return kind;
+}
+
+void invalidate_img(PlTerm t) {
+    HandleRef *ref = term2ref(t, HANDLE_IMG);
+    if (ref->frame >= 0)
+        ((ImgSeq *) ref->res->obj)->invalidate(ref->frame);
+}
+
+VideoCapture *term2video(PlTerm t) {
+    return (VideoCapture *) term2resource(t, KIND_VIDEO)->obj;
+}
+
+ImgSeq *term2seq(PlTerm t) {
+    return (ImgSeq *) term2resource(t, KIND_SEQ)->obj;
+}
+
+PackedBuffer *term2buffer(PlTerm t) {
+    return (PackedBuffer *) term2resource(t, KIND_BUF)->obj;
+}
+
+void release_handle(PlTerm t, int kind) {
+    HandleRef *ref = term2ref(t, kind_name(kind));
+    if (ref->frame >= 0)
+        return; // frames are released with their sequence
+    Resource *res = ref->res;
+    unique_lock<mutex> lock(res->mtx);
+    if (res->released) {
+        lock.unlock();
+        throw PlExistenceError(kind_name(kind), t);
+    }
+    res->released = true;
+    resource_update(res, lock);
+}
+
+#endif
@@ -0,0 +1,161 @@
+/* Image sequence containers
+ *     Common interface of all image sequences handled by the samplers
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _IMGSEQ_HPP
+#define _IMGSEQ_HPP
+
+#include "framecache.hpp"
+#include "memo.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+/********** declaration **********/
+
+/* frame z of a sequence could not be read (sequences decoding frames on
+ * demand), the predicates raise it as existence_error(frame, Z)
+ */
+struct FrameError : public runtime_error {
+    int frame;
+    explicit FrameError(int z)
+        : runtime_error("reading frame failed"), frame(z) {}
+};
+
+/* An image sequence (W x H x D volume of Lab pixels)
+ * Samplers only talk to this interface, so the frames can be kept in
+ * memory, decoded on demand or mapped from disk.
+ */
+class ImgSeq {
+public:
+    virtual ~ImgSeq() {}
+    // frame size and number of frames
+    virtual int width() = 0;
+    virtual int height() = 0;
+    virtual int depth() = 0;
+    /* get frame z (0 <= z < depth()), the returned Mat shares its data
+     * with the sequence, so drawing on it changes the sequence
+     */
+    virtual Mat frame(int z) = 0;
+    /* get a stable pointer to frame z, it stays valid until the sequence
+     * is released, or while frame z is pinned for sequences keeping only
+     * some frames (used for image handles, e.g. seq_img/3)
+     */
+    virtual Mat *frame_ref(int z) = 0;
+    // an image handle of frame z is created / garbage collected
+    virtual void pin_frame(int z) {}
+    virtual void unpin_frame(int z) {}
+    // size of the 3d space, Scalar(W, H, D)
+    Point3i bound() { return Point3i(width(), height(), depth()); }
+    /* drop everything computed from frame z (all frames if z < 0), must be
+     * called after drawing on the frames
+     */
+    void invalidate(int z = -1) {
+        integrals.invalidate(z);
+        gradients.invalidate(z);
+        histograms.invalidate(z);
+        memo.invalidate(z);
+    }
+
+    // preprocessing applied to the decoded frames (-1/0: unknown/none)
+    int color_code = -1; // cvtColor code
+    int blur_size = 0; // medianBlur kernel size
+    // integral images for box neighbourhoods, built lazily
+    FrameCache<FrameIntegral> integrals{INTEGRAL_CACHE_FRAMES};
+    // Scharr gradient maps, built lazily
+    FrameCache<FrameGradient> gradients{GRADIENT_CACHE_FRAMES};
+    // integral colour histograms for regions, built lazily
+    FrameCache<FrameHistogram> histograms{HISTOGRAM_CACHE_FRAMES};
+    // results of repeated samplings
+    MemoCache memo{MEMO_CACHE_ENTRIES};
+};
+
+/* Image sequence stored as one contiguous W x H x D volume
+ *     (a single aligned allocation, frames follow each other)
+ * "frames" is a vector<Mat> view on the volume for code that works on
+ *     separate images, writing into them writes into the volume.
+ */
+class Volume : public ImgSeq {
+public:
+    // allocate a volume of w x h x d elements of OpenCV type (e.g. CV_8UC3)
+    Volume(int w, int h, int d, int type);
+    ~Volume();
+    int width() { return w; }
+    int height() { return h; }
+    int depth() { return d; }
+    Mat frame(int z) { return frames[z]; }
+    Mat *frame_ref(int z) { return &frames[z]; }
+    // address of voxel (x, y, z)
+    uchar *voxel(int x, int y, int z) {
+        return data + x * step[0] + y * step[1] + z * step[2];
+    }
+
+    uchar *data;
+    size_t step[3]; // bytes between neighbouring voxels in x, y and z
+    vector<Mat> frames; // compatibility view, headers on data
+protected:
+    // wrap external data (not freed by the volume)
+    Volume(int w, int h, int d, int type, uchar *data,
+           size_t row_step, size_t frame_step);
+    void make_frames(int type);
+
+    int w, h, d;
+    bool owner; // whether data is allocated by the volume
+};
+
+/* Image sequence whose frames are separately stored in memory */
+class MatSeq : public ImgSeq {
+public:
+    MatSeq() {}
+    explicit MatSeq(const vector<Mat> &imgs) : frames(imgs) {}
+    int width() { return frames.empty() ? 0 : frames[0].cols; }
+    int height() { return frames.empty() ? 0 : frames[0].rows; }
+    int depth() { return (int) frames.size(); }
+    Mat frame(int z) { return frames[z]; }
+    Mat *frame_ref(int z) { return &frames[z]; }
+
+    vector<Mat> frames;
+};
+
+/*********** implementation ************/
+Volume::Volume(int w, int h, int d, int type)
+    : w(w), h(h), d(d), owner(true) {
+    size_t elem = CV_ELEM_SIZE(type);
+    step[0] = elem;
+    step[1] = w * elem;
+    // keep every frame cache line aligned
+    step[2] = (step[1] * h + 63) & ~((size_t) 63);
+    data = (uchar *) fastMalloc(step[2] * (d > 0 ? d : 1));
+    make_frames(type);
+}
+
+Volume::Volume(int w, int h, int d, int type, uchar *data,
+               size_t row_step, size_t frame_step)
+    : data(data), w(w), h(h), d(d), owner(false) {
+    step[0] = CV_ELEM_SIZE(type);
+    step[1] = row_step;
+    step[2] = frame_step;
+    make_frames(type);
+}
+
+Volume::~Volume() {
+    frames.clear();
+    if (owner)
+        fastFree(data);
+}
+
+void Volume::make_frames(int type) {
+    frames.reserve(d);
+    for (int z = 0; z < d; z++)
+        frames.push_back(Mat(h, w, type, data + z * step[2], step[1]));
+}
+
+#endif
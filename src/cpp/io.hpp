@@ -8,7 +8,7 @@
 #ifndef _IO_HPP
 #define _IO_HPP
 
-#include "memread.hpp"
+#include "imgseq.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -19,6 +19,13 @@
 
 #include <iostream> // for standard I/O
 #include <string>   // for strings
+#include <list>
+#include <queue>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 
 using namespace std;
 using namespace cv;
@@ -28,9 +35,107 @@ using namespace cv;
 Mat* cv_load_img(string path);
 // load an video into stack
 VideoCapture *cv_load_video(string path);
+/* options of transforming a video into an image sequence
+ * @threads: number of preprocessing workers, 1 means decoding and
+ *     preprocessing serially in the calling thread
+ * @start, @end, @step: load frames start, start + step, ... < end
+ *     (end < 0 means the end of the video)
+ * @crop: region of interest of every frame (empty means whole frame)
+ * @downscale: frames (after cropping) are shrinked by this factor (>= 1)
+ */
+struct SeqOptions {
+    int threads;
+    long start;
+    long end;
+    long step;
+    Rect crop;
+    double downscale;
+    SeqOptions() : start(0), end(-1), step(1), crop(0, 0, 0, 0),
+                   downscale(1.0) {
+        threads = thread::hardware_concurrency();
+        if (threads < 1)
+            threads = 1;
+    }
+};
+
+/* Bounded blocking FIFO queue shared by producer and consumer threads
+ * pop() returns false once the queue is closed and drained
+ */
+template <class Type>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+    void push(Type item);
+    bool pop(Type &item);
+    void close();
+private:
+    size_t capacity;
+    bool closed;
+    queue<Type> items;
+    mutex mtx;
+    condition_variable not_full;
+    condition_variable not_empty;
+};
+
+// median blur a decoded frame and convert it with color code
+void cv_preprocess_frame(Mat &frame, int code);
+/* same as above, but crop (roi) and downscale the frame first and write
+ * the result into dst (a frame of a volume), fails if the processed frame
+ * does not fit into dst
+ */
+bool cv_preprocess_frame(Mat &frame, int code, Rect roi, Mat &dst);
+/* transform video as an image sequence with color code, frames are
+ *     decoded in the calling thread and preprocessed by a pool of
+ *     opt.threads workers directly into their slots of a contiguous volume
+ */
+Volume *cv_video2seq(VideoCapture *vid, int code,
+                     SeqOptions opt = SeqOptions());
 // transform video as an image sequence and transform to Lab color
-vector<Mat> *cv_video2imgseq(VideoCapture *vid);
-vector<Mat> *cv_video2greyseq(VideoCapture *vid); // to greyscale
+Volume *cv_video2imgseq(VideoCapture *vid, SeqOptions opt = SeqOptions());
+// to greyscale
+Volume *cv_video2greyseq(VideoCapture *vid, SeqOptions opt = SeqOptions());
+
+/* Image sequence that decodes (and preprocesses) video frames on first
+ *     access, at most "budget" decoded frames are kept (least recently
+ *     used frames are dropped first), frames pinned by image handles
+ *     count against the budget.
+ * The depth is the frame count reported by the container, which is only an
+ *     estimate for many formats: a failed read shrinks the depth to the
+ *     frame that could not be read. Frames that cannot be read raise
+ *     FrameError and are not kept.
+ * The video is borrowed: DO NOT release it before the sequence.
+ * Frames drawn on may be lost when they are dropped from the window.
+ */
+class LazySeq : public ImgSeq {
+public:
+    LazySeq(VideoCapture *vid, size_t budget, int code = COLOR_BGR2Lab);
+    ~LazySeq();
+    int width() { return w; }
+    int height() { return h; }
+    int depth() { return d.load(); }
+    Mat frame(int z);
+    Mat *frame_ref(int z);
+    void pin_frame(int z);
+    void unpin_frame(int z);
+private:
+    Mat decode(int z); // caller holds the lock
+    void shrink_depth(int end); // the video has no frames from "end" on
+    // number of pinned frames outside the window, caller holds the lock
+    size_t pinned_outside();
+
+    VideoCapture *vid;
+    size_t budget; // max number of decoded frames in window and pinned
+    int code; // color conversion code
+    int w, h;
+    atomic<int> d; // shrinks when the real end of the video is found
+    long next_pos; // index of the frame that vid->read() returns next
+    list<int> lru; // frame indices, most recently used first
+    unordered_map<int, pair<Mat, list<int>::iterator>> window;
+    // frames of image handles: the frame (NULL until frame_ref()) and the
+    // number of handles
+    unordered_map<int, pair<Mat*, long>> pinned;
+    mutex mtx;
+};
 
 
 /*********** implementation ************/
@@ -51,52 +156,249 @@ VideoCapture *cv_load_video(string path) {
     return vid;
 }
 
-vector<Mat> *cv_video2imgseq(VideoCapture *vid) {
+void cv_preprocess_frame(Mat &frame, int code) {
+    medianBlur(frame, frame, 5);
+    // convert to LAB space (comparing to
+    //     RGB color space, Lab is closer to human cognition)
+    cvtColor(frame, frame, code);
+}
+
+bool cv_preprocess_frame(Mat &frame, int code, Rect roi, Mat &dst) {
+    if (roi.x + roi.width > frame.cols || roi.y + roi.height > frame.rows) {
+        cerr << "Frame size " << frame.cols << "x" << frame.rows
+             << " differs from the video size!" << endl;
+        return false;
+    }
+    Mat img;
+    medianBlur(frame(roi), img, 5);
+    if (img.cols != dst.cols || img.rows != dst.rows)
+        resize(img, img, Size(dst.cols, dst.rows), 0, 0, INTER_AREA);
+    // dst already has the right size and type, so cvtColor writes in place
+    cvtColor(img, dst, code);
+    return true;
+}
+
+template <class Type>
+void BoundedQueue<Type>::push(Type item) {
+    unique_lock<mutex> lock(mtx);
+    not_full.wait(lock, [this] { return items.size() < capacity; });
+    items.push(item);
+    not_empty.notify_one();
+}
+
+template <class Type>
+bool BoundedQueue<Type>::pop(Type &item) {
+    unique_lock<mutex> lock(mtx);
+    not_empty.wait(lock, [this] { return !items.empty() || closed; });
+    if (items.empty())
+        return false;
+    item = items.front();
+    items.pop();
+    not_full.notify_one();
+    return true;
+}
+
+template <class Type>
+void BoundedQueue<Type>::close() {
+    lock_guard<mutex> lock(mtx);
+    closed = true;
+    not_empty.notify_all();
+}
+
+Volume *cv_video2seq(VideoCapture *vid, int code, SeqOptions opt) {
     long frame_total = vid->get(CV_CAP_PROP_FRAME_COUNT);
-    vid->set(CAP_PROP_POS_FRAMES, 0); // set the read point to the beginning
-    bool stop = false;
-    Mat frame;
-    vector<Mat> *seq = new vector<Mat>;
-    long frame_current = 0;
-
-    while(!stop && frame_current < frame_total) {
-        if(!vid->read(frame)) {
-            cout << "Reading frame " << frame_current
-                 << " failed" << endl;
-            return FALSE;
+    int wid = vid->get(CAP_PROP_FRAME_WIDTH);
+    int hei = vid->get(CAP_PROP_FRAME_HEIGHT);
+    // frame range
+    long start = opt.start > 0 ? opt.start : 0;
+    long end = (opt.end < 0 || opt.end > frame_total) ? frame_total : opt.end;
+    long step = opt.step > 0 ? opt.step : 1;
+    long dur = start < end ? (end - start + step - 1) / step : 0;
+    // region of interest and size of loaded frames
+    Rect roi = Rect(0, 0, wid, hei);
+    if (opt.crop.area() > 0)
+        roi = roi & opt.crop;
+    double scale = opt.downscale > 1.0 ? opt.downscale : 1.0;
+    int out_wid = cvRound(roi.width / scale);
+    int out_hei = cvRound(roi.height / scale);
+    if (dur <= 0 || out_wid <= 0 || out_hei <= 0) {
+        cerr << "Nothing to load: empty frame range or region!" << endl;
+        return NULL;
+    }
+    vid->set(CAP_PROP_POS_FRAMES, start); // set the read point to start
+    int type = (code == COLOR_BGR2GRAY) ? CV_8UC1 : CV_8UC3;
+    Volume *seq = new Volume(out_wid, out_hei, dur, type);
+    seq->color_code = code;
+    seq->blur_size = 5;
+    bool failed = false;
+
+    if (opt.threads <= 1) {
+        for (long z = 0; z < dur; ++z) {
+            Mat frame;
+            if(!vid->read(frame)) {
+                cout << "Reading frame " << start + z * step
+                     << " failed" << endl;
+                failed = true;
+                break;
+            }
+            if (!cv_preprocess_frame(frame, code, roi, seq->frames[z])) {
+                failed = true;
+                break;
+            }
+            // skip frames between two loaded frames without decoding
+            for (long s = 1; s < step && z < dur - 1; s++)
+                vid->grab();
         }
-        medianBlur(frame, frame, 5);
-        // convert to LAB space (comparing to
-        //     RGB color space, Lab is closer to human cognition)
-        cvtColor(frame, frame, COLOR_BGR2Lab); 
-        seq->push_back(frame.clone());
-        ++frame_current;
+    } else {
+        // workers write each frame into its own slot, so the sequence
+        // is in order without further synchronization
+        BoundedQueue<pair<long, Mat>> jobs(2 * opt.threads);
+        vector<thread> workers;
+        atomic<bool> bad_frame(false);
+        for (int t = 0; t < opt.threads; t++)
+            workers.push_back(thread([&jobs, &bad_frame, seq, code, roi] {
+                pair<long, Mat> job;
+                while (jobs.pop(job))
+                    if (!cv_preprocess_frame(job.second, code, roi,
+                                             seq->frames[job.first]))
+                        bad_frame = true;
+            }));
+        for (long z = 0; z < dur; ++z) {
+            Mat frame; // a fresh buffer, the queue owns the last one
+            if(!vid->read(frame)) {
+                cout << "Reading frame " << start + z * step
+                     << " failed" << endl;
+                failed = true;
+                break;
+            }
+            jobs.push(make_pair(z, frame));
+            for (long s = 1; s < step && z < dur - 1; s++)
+                vid->grab();
+        }
+        jobs.close();
+        for (auto it = workers.begin(); it != workers.end(); ++it)
+            it->join();
+        failed = failed || bad_frame;
+    }
+    if (failed) {
+        delete seq;
+        return NULL;
     }
     return seq;
 }
 
-vector<Mat> *cv_video2greyseq(VideoCapture *vid) {
-    long frame_total = vid->get(CV_CAP_PROP_FRAME_COUNT);
-    vid->set(CAP_PROP_POS_FRAMES, 0); // set the read point to the beginning
-    bool stop = false;
+Volume *cv_video2imgseq(VideoCapture *vid, SeqOptions opt) {
+    return cv_video2seq(vid, COLOR_BGR2Lab, opt);
+}
+
+Volume *cv_video2greyseq(VideoCapture *vid, SeqOptions opt) {
+    return cv_video2seq(vid, COLOR_BGR2GRAY, opt);
+}
+
+LazySeq::LazySeq(VideoCapture *vid, size_t budget, int code)
+    : vid(vid), budget(budget > 0 ? budget : 1), code(code), next_pos(-1) {
+    w = vid->get(CAP_PROP_FRAME_WIDTH);
+    h = vid->get(CAP_PROP_FRAME_HEIGHT);
+    // the reported count may be off, decode() finds the real end lazily
+    d = max(0, (int) vid->get(CAP_PROP_FRAME_COUNT));
+    color_code = code;
+    blur_size = 5;
+}
+
+LazySeq::~LazySeq() {
+    for (auto it = pinned.begin(); it != pinned.end(); ++it)
+        delete it->second.first;
+}
+
+Mat LazySeq::decode(int z) {
     Mat frame;
-    vector<Mat> *seq = new vector<Mat>;
-    long frame_current = 0;
-
-    while(!stop && frame_current < frame_total) {
-        if(!vid->read(frame)) {
-            cout << "Reading frame " << frame_current
-                 << " failed" << endl;
-            return FALSE;
+    // seeking is slow and not frame accurate for most codecs, so skip
+    // forward by grabbing when the requested frame is close ahead
+    if (next_pos < 0 || z < next_pos || z - next_pos > 16) {
+        vid->set(CAP_PROP_POS_FRAMES, z);
+        next_pos = z;
+    }
+    while (next_pos < z) {
+        if (!vid->grab()) {
+            // the video ends before the reported frame count
+            shrink_depth(next_pos);
+            next_pos = -1;
+            throw FrameError(z);
         }
-        medianBlur(frame, frame, 5);
-        // convert to LAB space (comparing to
-        //     RGB color space, Lab is closer to human cognition)
-        cvtColor(frame, frame, COLOR_BGR2GRAY); 
-        seq->push_back(frame.clone());
-        ++frame_current;
+        ++next_pos;
     }
-    return seq;
+    if (!vid->read(frame)) {
+        cout << "Reading frame " << z << " failed" << endl;
+        shrink_depth(z);
+        next_pos = -1;
+        throw FrameError(z);
+    }
+    ++next_pos;
+    Mat img(h, w, code == COLOR_BGR2GRAY ? CV_8UC1 : CV_8UC3);
+    if (!cv_preprocess_frame(frame, code, Rect(0, 0, w, h), img))
+        throw FrameError(z);
+    return img;
+}
+
+void LazySeq::shrink_depth(int end) {
+    if (end < d)
+        d = end;
+}
+
+size_t LazySeq::pinned_outside() {
+    size_t n = 0;
+    for (auto it = pinned.begin(); it != pinned.end(); ++it)
+        if (it->second.first && window.find(it->first) == window.end())
+            n++;
+    return n;
+}
+
+Mat LazySeq::frame(int z) {
+    lock_guard<mutex> lock(mtx);
+    auto found = window.find(z);
+    if (found != window.end()) {
+        // move to the front of the LRU list
+        lru.splice(lru.begin(), lru, found->second.second);
+        return found->second.first;
+    }
+    auto pin = pinned.find(z);
+    if (pin != pinned.end() && pin->second.first)
+        return *(pin->second.first);
+    Mat img = decode(z); // nothing is kept if decoding fails
+    // drop least recently used frames to stay within the budget
+    size_t outside = pinned_outside();
+    while (!lru.empty() && window.size() + outside >= budget) {
+        window.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(z);
+    window[z] = make_pair(img, lru.begin());
+    return img;
+}
+
+Mat *LazySeq::frame_ref(int z) {
+    Mat img = frame(z);
+    lock_guard<mutex> lock(mtx);
+    // frames are referenced through image handles, which pin them
+    pair<Mat*, long> &pin = pinned[z];
+    // pinned frames share data with the window and outlive its eviction
+    if (!pin.first)
+        pin.first = new Mat(img);
+    return pin.first;
+}
+
+void LazySeq::pin_frame(int z) {
+    lock_guard<mutex> lock(mtx);
+    pinned[z].second++;
+}
+
+void LazySeq::unpin_frame(int z) {
+    lock_guard<mutex> lock(mtx);
+    auto pin = pinned.find(z);
+    if (pin == pinned.end() || --pin->second.second > 0)
+        return;
+    delete pin->second.first;
+    pinned.erase(pin);
 }
 
 #endif
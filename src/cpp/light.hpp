@@ -0,0 +1,235 @@
+/* Light source voting
+ *     Rays of the best radial directions of sampled points are intersected
+ *     pairwise, the intersections vote in a coarse grid and the peaks are
+ *     refined with mean-shift (a Hough transform of light sources).
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _LIGHT_HPP
+#define _LIGHT_HPP
+
+#include "sampler.hpp"
+#include "imgseq.hpp"
+#include "pool.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// maximal mean-shift iterations of a peak
+#define LIGHT_SHIFT_ITERS 20
+
+/********** declaration **********/
+
+/* a light ray ending at a sampled point
+ * @point: the sampled point
+ * @dir: best radial direction of the point (see cv_best_radial_dirs), the
+ *     light comes from point + t * (point - dir), t > 0, as
+ *     ray_source_intsct/3 of light source abduction
+ */
+struct LightRay {
+    Point3i point;
+    Point3i dir;
+};
+
+/* a light source hypothesis
+ * @pos: position (may be outside of the frame)
+ * @votes: number of ray intersections within the cell size around pos
+ */
+struct LightSource {
+    Point3i pos;
+    long votes;
+};
+
+/* options of light source voting
+ * @points: number of sampled points
+ * @step, @best: radial directions are multiples of step DEG, the best
+ *     ceil(#directions * best) of every point are its rays
+ * @pos_T, @neg_T, @min_changed: thresholds of cv_best_radial_dirs
+ * @cell: size of the voting cells, also the mean-shift window
+ * @top_k: number of returned sources
+ * @seed: seed of sampling the points
+ */
+struct LightOptions {
+    long points;
+    int step;
+    double best;
+    double pos_T, neg_T;
+    int min_changed;
+    int cell;
+    long top_k;
+    unsigned long seed;
+    LightOptions() : points(50), step(30), best(0.5), pos_T(2), neg_T(-1),
+                     min_changed(20), cell(16), top_k(5), seed(0) {}
+};
+
+/* sample points of frame and return the rays of their best directions
+ *     (directions with ratio < 0 are dropped)
+ */
+vector<LightRay> cv_light_rays(ImgSeq *images, int frame, LightOptions opt);
+
+/* vote for light sources with the intersections of all pairs of rays of
+ *     different points
+ * @bound: size of the frame, intersections further than its larger side
+ *     from the frame do not vote
+ * @return: at most opt.top_k sources in decreasing order of votes
+ */
+vector<LightSource> cv_vote_light_sources(const vector<LightRay> &rays,
+                                          Point3i bound, LightOptions opt);
+
+/*********** implementation ************/
+vector<LightRay> cv_light_rays(ImgSeq *images, int frame, LightOptions opt) {
+    vector<LightRay> rays;
+    if (frame < 0 || frame >= images->depth() || opt.points < 1 ||
+        opt.step < 1)
+        return rays;
+    // positions are drawn serially, so they only depend on the seed
+    mt19937 rng(opt.seed);
+    uniform_int_distribution<int> rand_x(0, images->width() - 1);
+    uniform_int_distribution<int> rand_y(0, images->height() - 1);
+    vector<Point3i> pts(opt.points);
+    for (auto it = pts.begin(); it != pts.end(); ++it) {
+        int x = rand_x(rng);
+        *it = Point3i(x, rand_y(rng), frame);
+    }
+    size_t k = (size_t) ceil((359 / opt.step + 1) * opt.best);
+    vector<vector<RadialDir> > dirs(pts.size());
+    shared_pool()->parallel_for(pts.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                dirs[i] = cv_best_radial_dirs(images, pts[i], 0, 359,
+                                              opt.step, opt.pos_T, opt.neg_T,
+                                              opt.min_changed, k);
+        }, 2, 1);
+    for (size_t i = 0; i < pts.size(); i++)
+        for (auto it = dirs[i].begin(); it != dirs[i].end(); ++it)
+            if (it->ratio >= 0) {
+                LightRay ray = {pts[i], it->dir};
+                rays.push_back(ray);
+            }
+    return rays;
+}
+
+vector<LightSource> cv_vote_light_sources(const vector<LightRay> &rays,
+                                          Point3i bound, LightOptions opt) {
+    vector<LightSource> re;
+    size_t n = rays.size();
+    int cell = max(opt.cell, 1);
+    if (n < 2 || opt.top_k < 1)
+        return re;
+    // rays in struct-of-arrays form for the pairwise loop
+    vector<double> sx(n), sy(n), dx(n), dy(n);
+    for (size_t i = 0; i < n; i++) {
+        sx[i] = rays[i].point.x;
+        sy[i] = rays[i].point.y;
+        dx[i] = rays[i].point.x - (double) rays[i].dir.x;
+        dy[i] = rays[i].point.y - (double) rays[i].dir.y;
+    }
+    // intersections sx + u * dx = sx' + v * dx' with u, v > 0, in front of
+    // both points, collected per first ray
+    double margin = max(bound.x, bound.y);
+    vector<vector<Point2d> > hits(n);
+    shared_pool()->parallel_for(n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                for (size_t j = i + 1; j < n; j++) {
+                    if (rays[i].point == rays[j].point)
+                        continue;
+                    double det = dx[j] * dy[i] - dy[j] * dx[i];
+                    if (det == 0)
+                        continue; // parallel
+                    double ox = sx[j] - sx[i], oy = sy[j] - sy[i];
+                    double u = (oy * dx[j] - ox * dy[j]) / det;
+                    double v = (oy * dx[i] - ox * dy[i]) / det;
+                    if (u <= 0 || v <= 0)
+                        continue;
+                    double x = sx[i] + u * dx[i], y = sy[i] + u * dy[i];
+                    if (x < -margin || x >= bound.x + margin ||
+                        y < -margin || y >= bound.y + margin)
+                        continue;
+                    hits[i].push_back(Point2d(x, y));
+                }
+        }, 64, 8);
+    vector<Point2d> pts;
+    for (auto it = hits.begin(); it != hits.end(); ++it)
+        pts.insert(pts.end(), it->begin(), it->end());
+    if (pts.empty())
+        return re;
+
+    // coarse votes on the extended frame
+    int gw = (int) ((bound.x + 2 * margin) / cell) + 1;
+    int gh = (int) ((bound.y + 2 * margin) / cell) + 1;
+    vector<long> grid((size_t) gw * gh, 0);
+    for (auto it = pts.begin(); it != pts.end(); ++it)
+        grid[(size_t) ((it->y + margin) / cell) * gw +
+             (size_t) ((it->x + margin) / cell)]++;
+    vector<size_t> peaks;
+    for (size_t c = 0; c < grid.size(); c++)
+        if (grid[c] > 0)
+            peaks.push_back(c);
+    size_t n_peaks = min(peaks.size(), (size_t) (4 * opt.top_k));
+    partial_sort(peaks.begin(), peaks.begin() + n_peaks, peaks.end(),
+                 [&](size_t a, size_t b) {
+                     return grid[a] != grid[b] ? grid[a] > grid[b] : a < b;
+                 });
+
+    // mean-shift from the centres of the best cells, flat window of cell
+    double r2 = (double) cell * cell;
+    vector<pair<Point2d, long> > modes;
+    for (size_t p = 0; p < n_peaks; p++) {
+        Point2d c((peaks[p] % gw + 0.5) * cell - margin,
+                  (peaks[p] / gw + 0.5) * cell - margin);
+        long votes = 0;
+        for (int iter = 0; iter < LIGHT_SHIFT_ITERS; iter++) {
+            double mx = 0, my = 0;
+            votes = 0;
+            for (auto it = pts.begin(); it != pts.end(); ++it) {
+                double ex = it->x - c.x, ey = it->y - c.y;
+                if (ex * ex + ey * ey <= r2) {
+                    mx += it->x;
+                    my += it->y;
+                    votes++;
+                }
+            }
+            if (votes == 0)
+                break;
+            Point2d next(mx / votes, my / votes);
+            double shift = (next.x - c.x) * (next.x - c.x)
+                + (next.y - c.y) * (next.y - c.y);
+            c = next;
+            if (shift < 0.25)
+                break;
+        }
+        if (votes > 0)
+            modes.push_back(make_pair(c, votes));
+    }
+    // peaks converging to one mode are reported once
+    stable_sort(modes.begin(), modes.end(),
+                [](const pair<Point2d, long> &a,
+                   const pair<Point2d, long> &b) {
+                    return a.second > b.second;
+                });
+    int frame = rays[0].point.z;
+    for (auto it = modes.begin();
+         it != modes.end() && re.size() < (size_t) opt.top_k; ++it) {
+        Point3i pos(cvRound(it->first.x), cvRound(it->first.y), frame);
+        bool dup = false;
+        for (auto jt = re.begin(); jt != re.end() && !dup; ++jt) {
+            double ex = pos.x - jt->pos.x, ey = pos.y - jt->pos.y;
+            dup = ex * ex + ey * ey <= r2;
+        }
+        if (!dup) {
+            LightSource src = {pos, it->second};
+            re.push_back(src);
+        }
+    }
+    return re;
+}
+
+#endif
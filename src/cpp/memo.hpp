@@ -0,0 +1,175 @@
+/* Memo of sampling results of image sequences
+ *     Samplings (e.g. radial directions of a point) are asked again and
+ *     again by abduction, their results are kept per sequence and dropped
+ *     with the frames they were computed from.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _MEMO_HPP
+#define _MEMO_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+using namespace cv;
+
+// number of sampling results kept per sequence
+#define MEMO_CACHE_ENTRIES 2048
+// reach of samplings that may read any frame
+#define MEMO_ALL_FRAMES INT_MAX
+
+// samplings whose results are memoized, each kind has one result type
+enum MemoKind {
+    MEMO_RADIAL_DIRS,   // vector<RadialDir>
+    MEMO_LINE_SCHARR,   // vector<Point3i>
+    MEMO_LINE_SEG_SCHARR,
+    MEMO_LINE_VAR,
+    MEMO_LINE_SEG_VAR
+};
+
+/********** declaration **********/
+
+/* a sampling: its kind, frame, the point, direction (or end point) and
+ * the other parameters (thresholds, radius, ...; unused ones are 0)
+ * @reach: frames frame - reach ... frame + reach are read by the sampling
+ */
+struct MemoKey {
+    int kind;
+    int frame;
+    int reach;
+    Point3i point;
+    Point3i dir;
+    array<double, 8> params;
+
+    bool operator==(const MemoKey &k) const {
+        return kind == k.kind && frame == k.frame && reach == k.reach &&
+            point == k.point && dir == k.dir && params == k.params;
+    }
+};
+
+struct MemoKeyHash {
+    size_t operator()(const MemoKey &k) const;
+};
+
+/* Bounded cache of sampling results, the least recently used results are
+ *     dropped beyond budget
+ * Thread safe, a result stays valid while it is held by a reader. Results
+ *     computed while the cache is invalidated are returned but not kept.
+ */
+class MemoCache {
+public:
+    explicit MemoCache(size_t budget)
+        : hits(0), misses(0), budget(budget), generation(0) {}
+    /* result of sampling key, compute() returns it (a Value) and is only
+     * called if it is not cached, Value must be the type of key.kind
+     */
+    template <class Value, class Func>
+    shared_ptr<const Value> get(const MemoKey &key, Func compute);
+    // drop the results read from frame z (all results if z < 0)
+    void invalidate(int z = -1);
+    // drop all results and reset the counters
+    void clear();
+    // number of cached results
+    size_t size();
+
+    atomic<long> hits;
+    atomic<long> misses;
+private:
+    typedef pair<shared_ptr<const void>, list<MemoKey>::iterator> Item;
+    size_t budget;
+    unsigned long generation; // number of invalidations
+    list<MemoKey> lru; // most recently used first
+    unordered_map<MemoKey, Item, MemoKeyHash> cache;
+    mutex mtx;
+};
+
+/*********** implementation ************/
+size_t MemoKeyHash::operator()(const MemoKey &k) const {
+    hash<long long> h_int;
+    hash<double> h_real;
+    size_t h = h_int(((long long) k.kind << 32) ^ (unsigned int) k.frame);
+    auto mix = [&h](size_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    };
+    mix(h_int(((long long) k.point.x << 32) ^ (unsigned int) k.point.y));
+    mix(h_int(((long long) k.dir.x << 32) ^ (unsigned int) k.dir.y));
+    mix(h_int(((long long) k.point.z << 32) ^ (unsigned int) k.dir.z));
+    for (auto it = k.params.begin(); it != k.params.end(); ++it)
+        mix(h_real(*it));
+    return h;
+}
+
+template <class Value, class Func>
+shared_ptr<const Value> MemoCache::get(const MemoKey &key, Func compute) {
+    unsigned long gen;
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            hits++;
+            lru.splice(lru.begin(), lru, it->second.second);
+            return static_pointer_cast<const Value>(it->second.first);
+        }
+        misses++;
+        gen = generation;
+    }
+    // compute unlocked, other samplings can be served meanwhile
+    shared_ptr<const Value> value = make_shared<const Value>(compute());
+
+    lock_guard<mutex> lock(mtx);
+    if (generation != gen) // frames may have been drawn on meanwhile
+        return value;
+    auto it = cache.find(key);
+    if (it != cache.end()) // computed by another thread
+        return static_pointer_cast<const Value>(it->second.first);
+    lru.push_front(key);
+    cache[key] = Item(value, lru.begin());
+    while (cache.size() > budget) {
+        cache.erase(lru.back());
+        lru.pop_back();
+    }
+    return value;
+}
+
+void MemoCache::invalidate(int z) {
+    lock_guard<mutex> lock(mtx);
+    generation++;
+    if (z < 0) {
+        cache.clear();
+        lru.clear();
+        return;
+    }
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (std::abs(it->first.frame - z) <= it->first.reach) {
+            lru.erase(it->second.second);
+            it = cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void MemoCache::clear() {
+    invalidate();
+    hits = 0;
+    misses = 0;
+}
+
+size_t MemoCache::size() {
+    lock_guard<mutex> lock(mtx);
+    return cache.size();
+}
+
+#endif
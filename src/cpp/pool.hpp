@@ -0,0 +1,185 @@
+/* Pool of worker threads for data parallel loops
+ *     Workers are started once and shared by all predicates of a library,
+ *     loops are split into chunks that write to disjoint output slots.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _POOL_HPP
+#define _POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// loops shorter than this run serially in the calling thread
+#define PARALLEL_MIN_ITEMS 4096
+// default smallest chunk of a loop handed to a worker
+#define PARALLEL_MIN_CHUNK 256
+
+/********** declaration **********/
+
+/* fixed number of worker threads executing jobs from a queue */
+class WorkerPool {
+public:
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+    // number of threads working on a loop (workers and the caller)
+    int size() { return workers.size() + 1; }
+    /* call func(begin, end) on chunks of [0, n) in parallel and return when
+     *     all chunks are done, the calling thread takes chunks as well
+     * Loops shorter than min_items, and loops started by a worker of the
+     *     pool (nested loops), run serially. Chunks have at least min_chunk
+     *     items (set both lower for loops of expensive items).
+     */
+    template <class Func>
+    void parallel_for(size_t n, Func func,
+                      size_t min_items = PARALLEL_MIN_ITEMS,
+                      size_t min_chunk = PARALLEL_MIN_CHUNK);
+private:
+    void work();
+
+    vector<thread> workers;
+    queue<function<void()> > jobs;
+    bool stop;
+    mutex mtx;
+    condition_variable has_job;
+};
+
+/* the pool shared by this library, created on first use with
+ *     pool_threads() threads
+ */
+shared_ptr<WorkerPool> shared_pool();
+/* number of threads of the shared pool, 0 (the default) means the number
+ *     of cores
+ */
+int pool_threads();
+/* change the number of threads, the pool is recreated on next use, loops
+ *     running on the old pool finish there
+ */
+void set_pool_threads(int threads);
+
+/*********** implementation ************/
+// whether the current thread is a worker of some pool
+thread_local bool in_pool_worker = false;
+
+WorkerPool::WorkerPool(int threads) : stop(false) {
+    for (int t = 1; t < threads; t++)
+        workers.push_back(thread(&WorkerPool::work, this));
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stop = true;
+    }
+    has_job.notify_all();
+    for (auto it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+}
+
+void WorkerPool::work() {
+    in_pool_worker = true;
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(mtx);
+            has_job.wait(lock, [this] { return stop || !jobs.empty(); });
+            if (jobs.empty())
+                return; // stopped
+            job = move(jobs.front());
+            jobs.pop();
+        }
+        job();
+    }
+}
+
+template <class Func>
+void WorkerPool::parallel_for(size_t n, Func func, size_t min_items,
+                              size_t min_chunk) {
+    if (n < max(min_items, (size_t) 2) || workers.empty() || in_pool_worker) {
+        func((size_t) 0, n);
+        return;
+    }
+    size_t chunk = max(max(min_chunk, (size_t) 1), n / (4 * size()));
+    size_t helpers = min(workers.size(), (n - 1) / chunk);
+
+    // chunks are claimed by the caller and helpers through "next"
+    atomic<size_t> next(0);
+    size_t done = 0; // finished helpers
+    exception_ptr error;
+    mutex loop_mtx;
+    condition_variable finished;
+    auto run = [&]() {
+        try {
+            size_t begin;
+            while ((begin = next.fetch_add(chunk)) < n)
+                func(begin, min(begin + chunk, n));
+        } catch (...) {
+            lock_guard<mutex> lock(loop_mtx);
+            if (!error)
+                error = current_exception();
+            next = n; // stop claiming chunks
+        }
+    };
+    {
+        lock_guard<mutex> lock(mtx);
+        for (size_t h = 0; h < helpers; h++)
+            jobs.push([&]() {
+                    run();
+                    lock_guard<mutex> lock(loop_mtx);
+                    if (++done == helpers)
+                        finished.notify_one();
+                });
+    }
+    has_job.notify_all();
+    run();
+    // helpers reference this frame, wait until all of them returned
+    unique_lock<mutex> lock(loop_mtx);
+    finished.wait(lock, [&] { return done == helpers; });
+    if (error)
+        rethrow_exception(error);
+}
+
+static mutex pool_mtx;
+static shared_ptr<WorkerPool> pool;
+static int pool_size = 0;
+
+shared_ptr<WorkerPool> shared_pool() {
+    lock_guard<mutex> lock(pool_mtx);
+    if (!pool) {
+        int threads = pool_size;
+        if (threads < 1)
+            threads = max((int) thread::hardware_concurrency(), 1);
+        pool = make_shared<WorkerPool>(threads);
+    }
+    return pool;
+}
+
+int pool_threads() {
+    lock_guard<mutex> lock(pool_mtx);
+    return pool_size;
+}
+
+void set_pool_threads(int threads) {
+    shared_ptr<WorkerPool> old;
+    {
+        lock_guard<mutex> lock(pool_mtx);
+        pool_size = max(threads, 0);
+        // the old workers are joined outside the lock (by the last user)
+        old = pool;
+        pool.reset();
+    }
+}
+
+#endif
@@ -8,11 +8,14 @@
 #define _SAMPLER_HPP
 
 #include "utils.hpp"
+#include "imgseq.hpp"
+#include "stencil.hpp"
+#include "contour.hpp"
+#include "pool.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>  // OpenCV window I/O
-#include <armadillo>
 #include <SWI-cpp.h>
 #include <SWI-Prolog.h>
 
@@ -21,6 +24,7 @@
 #include <algorithm>
 #include <string>   // for strings
 #include <cmath>
+#include <climits>
 
 using namespace std;
 using namespace cv;
@@ -31,6 +35,20 @@ enum { XY_SHIFT = 16, XY_ONE = 1 << XY_SHIFT, DRAWING_STORAGE_BLOCK = (1 << 12)
 
 /********* declarations *********/
 
+/* shape of the local area of a point
+ * @LOC_ELLIPSOID: pixels in the ellipsoid of the radius (exact)
+ * @LOC_BOX: pixels in the bounding box of the ellipsoid, computed from
+ *     integral images of the frames in O(1) per frame
+ */
+enum LocShape { LOC_ELLIPSOID, LOC_BOX };
+
+/* values sampled on the points of lines (cv_sample_lines)
+ * @LINE_COLOR: local Lab color (as pts_color), 3 values per point
+ * @LINE_SCHARR: Scharr gradient (as pts_scharr)
+ * @LINE_VAR: local variance (as pts_var)
+ */
+enum LineSampling { LINE_COLOR, LINE_SCHARR, LINE_VAR };
+
 /* bound an local area in 3-d space and return the left/right up/down most
  *     points of the local area
  * @point: center
@@ -38,36 +56,51 @@ enum { XY_SHIFT = 16, XY_ONE = 1 << XY_SHIFT, DRAWING_STORAGE_BLOCK = (1 << 12)
  * @bound: boundary of the global space (> 0)
  * @return: left/right up/down most point of this area (grid)
  */
-vector<Scalar> bound_scalar_3d(Scalar point, Scalar radius, Scalar bound);
+vector<Point3i> bound_scalar_3d(Point3i point, Scalar radius, Point3i bound);
+
+/* sums and sums of squares of each channel of the pixels in box
+ *     [x0, x1] x [y0, y1] x [z0, z1] (inside the sequence)
+ * @images: image sequence
+ * @sum, @sqsum: returned sums
+ * @return: number of pixels, 0 for an empty box (e.g. the clipped box of
+ *     a point outside of the sequence)
+ */
+long cv_imgs_box_sums(ImgSeq *images, int x0, int y0, int z0,
+                      int x1, int y1, int z1, Scalar &sum, Scalar &sqsum);
 
 /* get LAB color of a point (or average color in its neighborhood)
  * @images: image sequence
  * @point: position of the interest point
  * @radius: radius of the ellipsoid of the local area
+ * @shape: shape of the local area
  * @return: color in current location
  * REMARK: the 3 dimensions are width, height, duration
  */
-Scalar cv_imgs_point_color_loc(vector<Mat> *images, Scalar point,
-                               Scalar radius = Scalar(0, 0, 0));
+Scalar cv_imgs_point_color_loc(ImgSeq *images, Point3i point,
+                               Scalar radius = Scalar(0, 0, 0),
+                               int shape = LOC_ELLIPSOID);
 
 /* calculate image local variance
  * @images: image sequence
  * @point: position of the interest point
  * @radius: radius of the ellipsoid of the local area
+ * @shape: shape of the local area
  * @return: variation of all the points
  * REMARK: the 3 dimensions are width, height, duration
  */
-double cv_imgs_point_var_loc(vector<Mat> *images, Scalar point,
-                             Scalar radius = Scalar(3, 3, 0));
+double cv_imgs_point_var_loc(ImgSeq *images, Point3i point,
+                             Scalar radius = Scalar(3, 3, 0),
+                             int shape = LOC_ELLIPSOID);
 
 /* calculate image gradient with Scharr operator
+ *     (looked up in the gradient map of the frame, computed on first touch)
  * @images: image sequence
  * @point: position of the interest point
  * @return: variation of all the points 
  */
-double cv_imgs_point_scharr(vector<Mat> *images, Scalar point);
-vector<double> cv_imgs_points_scharr(vector<Mat> *images,
-                                     vector<Scalar> points);
+double cv_imgs_point_scharr(ImgSeq *images, Point3i point);
+vector<double> cv_imgs_points_scharr(ImgSeq *images,
+                                     const vector<Point3i> &points);
 
 /* calculate image local color of a set of points
  * @images: image sequence
@@ -76,9 +109,10 @@ vector<double> cv_imgs_points_scharr(vector<Mat> *images,
  * @return: variation of all the points
  * REMARK: the 3 dimensions are width, height, duration
  */
-vector<Scalar> cv_imgs_points_color_loc(vector<Mat> *images,
-                                        vector<Scalar> points,
-                                        Scalar radius = Scalar(0, 0, 0));
+vector<Scalar> cv_imgs_points_color_loc(ImgSeq *images,
+                                        const vector<Point3i> &points,
+                                        Scalar radius = Scalar(0, 0, 0),
+                                        int shape = LOC_ELLIPSOID);
 
 /* calculate image local variance of a set of points
  * @images: image sequence
@@ -87,24 +121,28 @@ vector<Scalar> cv_imgs_points_color_loc(vector<Mat> *images,
  * @return: variation of all the points
  * REMARK: the 3 dimensions are width, height, duration
  */
-vector<double> cv_imgs_points_var_loc(vector<Mat> *images,
-                                      vector<Scalar> points,
-                                      Scalar radius = Scalar(3, 3, 0));
-/* get all points on a line
+vector<double> cv_imgs_points_var_loc(ImgSeq *images,
+                                      const vector<Point3i> &points,
+                                      Scalar radius = Scalar(3, 3, 0),
+                                      int shape = LOC_ELLIPSOID);
+/* get all points on a line (inside the 3d-space)
  * @point: position of a point on the line
  * @direction: direction of the line
  * @bound: size of the 3d-space
  * @return: all points on the line
  */
-vector<Scalar> get_line_points(Scalar point, Scalar direction, Scalar bound);
+vector<Point3i> get_line_points(Point3i point, Point3i direction,
+                                Point3i bound);
 
-/* get all points on a line segment
+/* get all points on a line segment (inside the 3d-space, the end points
+ *     may be outside)
  * @start: position of a point on the line
  * @end: direction of the line
  * @bound: size of the 3d-space
  * @return: all points on the line segment
  */
-vector<Scalar> get_line_seg_points(Scalar start, Scalar end, Scalar bound);
+vector<Point3i> get_line_seg_points(Point3i start, Point3i end,
+                                    Point3i bound);
 
 /* get all points on an ellipse (ONLY FOR 2D IMAGE, SO z ALWAYS EQUALS TO 0)
  *    When sampling a specific frame, remember to change z value of all points
@@ -112,9 +150,26 @@ vector<Scalar> get_line_seg_points(Scalar start, Scalar end, Scalar bound);
  * @param: parameters of an ellipse (long/short axis length and
  *     axis angle (DEG, not RAD!!!))
  * @bound: size of the 3d-space
- * @return: all points on the circle
+ * @return: the points of the (cached) contour of the ellipse inside the
+ *     3d-space, ordered and without duplicates (see ellipse_contour)
+ */
+vector<Point3i> get_ellipse_points(Point3i centre, Scalar param,
+                                   Point3i bound);
+
+/* sample the points of many lines (or line segments) in one loop
+ * @images: image sequence
+ * @lines: pairs of a point on a line and its direction, or of the start
+ *     and end points of a segment if segs
+ * @kind: sampled values, see LineSampling
+ * @parallel: sample different lines in parallel
+ * @points: points of every line (get_line_points / get_line_seg_points)
+ * @values: sampled values of the points of every line
  */
-vector<Scalar> get_ellipse_points(Scalar centre, Scalar param, Scalar bound);
+void cv_sample_lines(ImgSeq *images,
+                     const vector<pair<Point3i, Point3i> > &lines, bool segs,
+                     int kind, bool parallel,
+                     vector<vector<Point3i> > &points,
+                     vector<vector<double> > &values);
 
 
 /* sample a line in 3d space and return the points whose local variance 
@@ -126,8 +181,8 @@ vector<Scalar> get_ellipse_points(Scalar centre, Scalar param, Scalar bound);
  * @loc_radius: local area size
  * @return: points meet the requirement
  */
-vector<Scalar> cv_line_pts_var_geq_T(vector<Mat> *images, Scalar point,
-                              Scalar direction, double var_threshold = 2.0,
+vector<Point3i> cv_line_pts_var_geq_T(ImgSeq *images, Point3i point,
+                              Point3i direction, double var_threshold = 2.0,
                               Scalar loc_radius = Scalar(5, 5, 0));
 
 /* sample a line in 3d space and return the points whose local variance 
@@ -139,8 +194,8 @@ vector<Scalar> cv_line_pts_var_geq_T(vector<Mat> *images, Scalar point,
  * @loc_radius: local area size
  * @return: points meet the requirement
  */
-vector<Scalar> cv_line_seg_pts_var_geq_T(vector<Mat> *images, Scalar start,
-                              Scalar end, double var_threshold = 2.0,
+vector<Point3i> cv_line_seg_pts_var_geq_T(ImgSeq *images, Point3i start,
+                              Point3i end, double var_threshold = 2.0,
                               Scalar loc_radius = Scalar(5, 5, 0));
 
 /* sample a line in 3d space and return the points whose scharr gradient
@@ -151,299 +206,341 @@ vector<Scalar> cv_line_seg_pts_var_geq_T(vector<Mat> *images, Scalar start,
  * @grad_threshold: variance threshold
  * @return: points meet the requirement
  */
-vector<Scalar> cv_line_pts_scharr_geq_T(vector<Mat> *images,
-                                        Scalar point,
-                                        Scalar direction,
-                                        double var_threshold = 5.0);
-vector<Scalar> cv_line_seg_pts_scharr_geq_T(vector<Mat> *images,
-                                            Scalar start,
-                                            Scalar end,
-                                            double var_threshold = 5.0);
+vector<Point3i> cv_line_pts_scharr_geq_T(ImgSeq *images,
+                                         Point3i point,
+                                         Point3i direction,
+                                         double var_threshold = 5.0);
+vector<Point3i> cv_line_seg_pts_scharr_geq_T(ImgSeq *images,
+                                             Point3i start,
+                                             Point3i end,
+                                             double var_threshold = 5.0);
+
+/* a direction of radial sampling and how the brightness changes along it
+ * @ratio: #grad+ / (#grad+ + #grad-) of the brightness (L channel)
+ *     gradients along the line, -1 if too few points changed
+ * @dir: direction of the line
+ */
+struct RadialDir {
+    double ratio;
+    Point3i dir;
+};
+
+/* sample the lines crossing a point in the directions (DEG) in
+ *     [start_deg, end_deg] that are multiples of step, and rank them by
+ *     the proportion of brightness increases (e.g. towards a light source)
+ * @images: image sequence
+ * @point: the point that all lines cross (its frame is sampled)
+ * @pos_T: gradients >= pos_T are counted as grad+
+ * @neg_T: gradients < neg_T are counted as grad-
+ * @min_changed: lines with #grad+ + #grad- <= min_changed get ratio -1
+ * @k: number of returned directions
+ * @return: the k directions with the largest ratios, in decreasing order
+ *     (ties: the later angle first)
+ */
+vector<RadialDir> cv_best_radial_dirs(ImgSeq *images, Point3i point,
+                                      int start_deg, int end_deg, int step,
+                                      double pos_T, double neg_T,
+                                      int min_changed, size_t k);
 
 /* bresenham's line algorithm
  * @current: starting point to be extended
  * @direction: direction of line extention
  * @inc: increment direction
  * @bound: 3-d space size
- * @&points: vector line points
- * @front: whether new points are pushed to vector's front
+ * @&points: vector line points, the points after current are appended
+ *     until the line leaves the 3-d space (nothing if the first one is
+ *     outside, e.g. when current is far outside)
+ */
+void bresenham(Point3i current, Point3i direction, Point3i inc,
+               Point3i bound, vector<Point3i> *points);
+
+/* clip a digital line against the 3-d space
+ *     The line starts from point "from" and takes k steps along its major
+ *     axis to its k-th point (as bresenham), each period of |delta| steps
+ *     moves it by delta (signs given by inc).
+ * @k0, @k1: range of steps to be clipped, narrowed to the steps whose
+ *     points are inside the 3-d space
+ * @return: false if no point in the range is inside
+ */
+bool clip_digital_line(Point3i from, Point3i delta, Point3i inc,
+                       Point3i bound, long long &k0, long long &k1);
+
+/* append points k0 ... k1 of a digital line (see above) without any
+ *     boundary check
+ */
+void digital_line(Point3i from, Point3i delta, Point3i inc,
+                  long long k0, long long k1, vector<Point3i> *points);
+/* the k-th point of a digital line (see above) in closed form, the same
+ *     point as digital_line steps to
  */
-void bresenham(Scalar current, Scalar direction, Scalar inc,
-               Scalar bound, vector<Scalar> *points);
+Point3i digital_line_point(Point3i from, Point3i delta, Point3i inc,
+                           long long k);
 
 /* fits a set of points in to a ellipse on an 2d image
+ *     The reduced 3x3 eigenproblem is solved in closed form on fixed-size
+ *     matrices, the points are normalized and scanned only twice.
  * Based on:
  *   Fitzgibbon, A.W., Pilu, M., and Fischer R.B., Direct least squares
  *   fitting of ellipsees, Proc. of the 13th Internation Conference on Pattern
  *   Recognition, pp 253–257, Vienna, 1996.
- * @points: points for fitting
+ *   Halir, R., and Flusser, J., Numerically stable direct least squares
+ *   fitting of ellipses, Proc. of the 6th International Conference in
+ *   Central Europe on Computer Graphics and Visualization, pp 125-132, 1998.
+ * @points: points for fitting (>= 5, the frame of the first one is used)
  * @centre: center of the ellipse
  * @param: other parameters (long/short axis length and axis angle)
+ * @return: false if the points do not determine an ellipse (too few,
+ *     collinear, or best fitted by a hyperbola)
  */
-void fit_ellipse(vector<Scalar> points, Scalar& centre, Scalar& param);
+bool fit_ellipse(const vector<Point3i> &points, Point3i &centre,
+                 Scalar &param);
+
+/* fit_ellipse on many point sets, in parallel
+ * @centres, @params: results, resized to the number of sets
+ * @return: whether each set was fitted
+ */
+vector<char> fit_ellipses(const vector<vector<Point3i> > &sets,
+                          vector<Point3i> &centres, vector<Scalar> &params);
+
+/* add the colours of points (those inside the sequence) to a histogram,
+ *     the pixels are read directly
+ */
+void hist_add_points(ImgSeq *images, const vector<Point3i> &points,
+                     ColorHist &hist);
+/* add the pixels of a rectangle (clipped) of frame z to a histogram, counted
+ *     from the (cached) integral histogram of the frame
+ */
+void hist_add_rect(ImgSeq *images, int z, Rect rect, ColorHist &hist);
+/* distance of two histograms: quadratic mean of the symmetric KL
+ *     divergences of the 3 channels, the distributions are smoothed with a
+ *     Dirichlet prior
+ */
+double hist_distance(const ColorHist &hist_1, const ColorHist &hist_2);
 
 /* Compare two sets of points' histogram distributions, return KL divergence
  * @images: image sequence
  * @points_1: point set 1
  * @points_2: point set 2
  */
-double compare_hist(vector<Mat> *images,
-                    vector<Scalar> points_1,
-                    vector<Scalar> points_2);
+double compare_hist(ImgSeq *images,
+                    const vector<Point3i> &points_1,
+                    const vector<Point3i> &points_2);
 
 /* determines whether a 3D point is out of a 3D space (positive)
  * @point: input point
  * @bound: boundary of the 3D space (>= 0)
  */
-bool out_of_canvas(Scalar point, Scalar bound) {
-    int x = point[0];
-    int y = point[1];
-    int z = point[2];
-    
-    if (x >= 0 && x <= bound[0] - 1 &&
-        y >= 0 && y <= bound[1] - 1 &&
-        z >= 0 && z <= bound[2] - 1) 
-        return false;
-    else
-        return true;
+bool out_of_canvas(Point3i point, Point3i bound) {
+    return !(point.x >= 0 && point.x < bound.x &&
+             point.y >= 0 && point.y < bound.y &&
+             point.z >= 0 && point.z < bound.z);
 }
 /* determines whether two points are continuous
  * @p1, p2: input points
  */
-bool point_cont(Scalar p1, Scalar p2) {
-    arma::vec v = {(double) abs(p1[0] - p2[0]),
-                   (double) abs(p1[1] - p2[1]),
-                   (double) abs(p1[2] - p2[2])};
-    if (v.max() < 2)
-        return true;
-    else
-        return false;
+bool point_cont(Point3i p1, Point3i p2) {
+    return abs(p1.x - p2.x) < 2 && abs(p1.y - p2.y) < 2 &&
+        abs(p1.z - p2.z) < 2;
 }
 
 
 /********* implementations *********/
-double cv_imgs_point_var_loc(vector<Mat> *images, Scalar point,
-                             Scalar radius) {
-    // get left_up_most and right_down_most and enumerate all pixels
-    int w = (*images)[0].cols;
-    int h = (*images)[0].rows;
-    int d = images->size();
-    vector<Scalar> bounds = bound_scalar_3d(point, radius, Scalar(w, h, d));
-    Scalar left_up_most = bounds[0];
-    Scalar right_down_most = bounds[1];
-
-    // enumerate pixels that position in local ellipsoid
-    // the ellipsoid is:
-    //  ((X - P1)/W)^2 + ((Y - P2)/H)^2 + ((Z - P3)/D )^2 = 1
-    
-    // collect pixels
-    vector<Scalar> point_set;
-    for (auto i = left_up_most[2]; i <= right_down_most[2]; i++)
-        for (auto r = left_up_most[1]; r <= right_down_most[1]; r++)
-            for (auto c = left_up_most[0]; c <= right_down_most[0]; c++) {
-                double p1, p2, p3;
-                p1 = radius[0] > 0 ?
-                    pow(((double) c - point[0])/radius[0], 2) : 0;
-                p2 = radius[1] > 0 ?
-                    pow(((double) r - point[1])/radius[1], 2) : 0;
-                p3 = radius[2] > 0 ?
-                    pow(((double) i - point[2])/radius[2], 2) : 0;
-                /* debug
-                cout << c << "-" << point[0] << ","
-                     << r << "-" << point[1] << ","
-                     << i << "-" << point[2] << "," << "\n\t";
-                cout << p1 << ","
-                     << p2 << ","
-                     << p3 << endl;
-                */
-                if (p1 + p2 + p3 <= 1.0) {
-                    point_set.push_back(Scalar(c, r, i));
-
-                }
-            }
-
-    int count = point_set.size();
-    Scalar avg = Scalar(.0, .0, .0);
-    // compute average
-    for (auto it = point_set.begin(); it != point_set.end(); ++it) {
-        Scalar pos = *it; // position of the pixel
-        Mat img = (*images)[pos[2]];
-        Vec3b pixel = img.at<Vec3b>(pos[1], pos[0]);
-        for (int channel = 0; channel < 3; channel++)
-            avg[channel] += pixel[channel];
-
+long cv_imgs_box_sums(ImgSeq *images, int x0, int y0, int z0,
+                      int x1, int y1, int z1, Scalar &sum, Scalar &sqsum) {
+    sum = Scalar(.0, .0, .0);
+    sqsum = Scalar(.0, .0, .0);
+    if (x1 < x0 || y1 < y0 || z1 < z0)
+        return 0;
+    for (int i = z0; i <= z1; i++) {
+        shared_ptr<FrameIntegral> fi =
+            images->integrals.get(i, [&]() { return images->frame(i); });
+        int cn = fi->sum.channels();
+        // corners of the box in the integral images (one pixel larger)
+        const double *s0 = fi->sum.ptr<double>(y0);
+        const double *s1 = fi->sum.ptr<double>(y1 + 1);
+        const double *q0 = fi->sqsum.ptr<double>(y0);
+        const double *q1 = fi->sqsum.ptr<double>(y1 + 1);
+        int l = x0 * cn, r = (x1 + 1) * cn;
+        for (int c = 0; c < cn && c < 3; c++) {
+            sum[c] += s1[r + c] - s0[r + c] - s1[l + c] + s0[l + c];
+            sqsum[c] += q1[r + c] - q0[r + c] - q1[l + c] + q0[l + c];
+        }
     }
-    
-    avg = avg/(double) count;
-    //cout << "avg:\t" << avg[0] << ", " << avg[1] << ", " << avg[2] << endl;    
-    // compute variance
-    Scalar var(.0, .0, .0);
-    for (auto it = point_set.begin(); it != point_set.end(); ++it) {
-        Scalar pos = *it; // position of the pixel
-        Mat img = (*images)[pos[2]];
-        Vec3b pixel = img.at<Vec3b>(pos[1], pos[0]);
+    return (long) (x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+}
+
+double cv_imgs_point_var_loc(ImgSeq *images, Point3i point,
+                             Scalar radius, int shape) {
+    if (shape == LOC_BOX) {
+        // bounding box of the local area
+        vector<Point3i> bounds = bound_scalar_3d(point, radius,
+                                                 images->bound());
+        Point3i left_up_most = bounds[0];
+        Point3i right_down_most = bounds[1];
+        Scalar sum, sqsum;
+        long count = cv_imgs_box_sums(images, left_up_most.x,
+                                      left_up_most.y, left_up_most.z,
+                                      right_down_most.x, right_down_most.y,
+                                      right_down_most.z, sum, sqsum);
+        if (count == 0)
+            return 0.0; // as an empty ellipsoid
+        double std = 0.0;
         for (int channel = 0; channel < 3; channel++) {
-            double res = pixel[channel] - avg[channel];
-            var[channel] += pow(res, 2);
+            double var = sqsum[channel] - sum[channel] * sum[channel] / count;
+            std += sqrt(max(var, 0.0) / (double) (count - 1));
         }
+        return std;
     }
 
-    //var = var/(double) (count - 1);
-    //cout << "var:\t" << var[0] << ", " << var[1] << ", " << var[2] << endl;
-    double std = sqrt(var[0] / (double) (count - 1))
-        + sqrt(var[1] / (double) (count - 1))
-        + sqrt(var[2] / (double) (count - 1));
+    // single pass (Welford) over the pixels in the local ellipsoid
+    long count = 0;
+    double mean[3] = {.0, .0, .0};
+    double m2[3] = {.0, .0, .0};
+    stencil_apply(images, point, radius, [&](const uchar *px) {
+            count++;
+            for (int channel = 0; channel < 3; channel++) {
+                double delta = px[channel] - mean[channel];
+                mean[channel] += delta / count;
+                m2[channel] += delta * (px[channel] - mean[channel]);
+            }
+        });
+    double std = sqrt(m2[0] / (double) (count - 1))
+        + sqrt(m2[1] / (double) (count - 1))
+        + sqrt(m2[2] / (double) (count - 1));
     return std;
 }
 
-double cv_imgs_point_scharr(vector<Mat> *images, Scalar point) {
-    // get left_up_most and right_down_most and enumerate all pixels
-    int w = (*images)[0].cols;
-    int h = (*images)[0].rows;
+double cv_imgs_point_scharr(ImgSeq *images, Point3i point) {
+    int w = images->width();
+    int h = images->height();
     // point position
-    int x = point[0];
-    int y = point[1];
-    int frame = point[2];
+    int x = point.x;
+    int y = point.y;
+    int frame = point.z;
     if (x < 1 || y < 1 || x > w - 2 || y > h - 2)
         return 0.0;
-    // build brightness matrix
-    Mat img = (*images)[frame];
-    arma::mat A = {{(double) img.at<Vec3b>(y-1, x-1)[0],
-                    (double) img.at<Vec3b>(y-1, x)[0],
-                    (double) img.at<Vec3b>(y-1, x+1)[0]},
-                   {(double) img.at<Vec3b>(y, x-1)[0],
-                    (double) img.at<Vec3b>(y, x)[0],
-                    (double) img.at<Vec3b>(y, x+1)[0]},
-                   {(double) img.at<Vec3b>(y+1, x-1)[0],
-                    (double) img.at<Vec3b>(y+1, x)[0],
-                    (double) img.at<Vec3b>(y+1, x+1)[0]}};
-    // calculate Scharr gradients in brightness channel
-    arma::mat gx = {{3, 10, 3},
-                    {0, 0, 0},
-                    {-3, -10, -3}};
-    arma::mat gy = {{3, 0, -3},
-                    {10, 0, -10},
-                    {3, 0, -3}};
-    gx = gx/32;
-    gy = gy/32;
-    double Gx = gx(2,2)*A(0,0) + gx(2,1)*A(0,1) + gx(2,0)*A(0,2)
-        + gx(1,2)*A(1,0) + gx(1,1)*A(1,1) + gx(1,0)*A(1,2)
-        + gx(0,2)*A(2,0) + gx(0,1)*A(2,1) + gx(0,0)*A(2,2);
-    double Gy = gy(2,2)*A(0,0) + gy(2,1)*A(0,1) + gy(2,0)*A(0,2)
-        + gy(1,2)*A(1,0) + gy(1,1)*A(1,1) + gy(1,0)*A(1,2)
-        + gy(0,2)*A(2,0) + gy(0,1)*A(2,1) + gy(0,0)*A(2,2);
-    double G = sqrt(Gx*Gx + Gy*Gy);
-    return G;
-}
-
-Scalar cv_imgs_point_color_loc(vector<Mat> *images, Scalar point,
-                               Scalar radius) {
-    // canvas size
-    int w = (*images)[0].cols;
-    int h = (*images)[0].rows;
-    int d = images->size();
-    // bounded neighborhood
-    vector<Scalar> bounds = bound_scalar_3d(point, radius, Scalar(w, h, d));
-    Scalar left_up_most = bounds[0];
-    Scalar right_down_most = bounds[1];
-    
-    // collect pixels 
-    vector<Scalar> point_set;
-    for (auto i = left_up_most[2]; i <= right_down_most[2]; i++)
-        for (auto r = left_up_most[1]; r <= right_down_most[1]; r++)
-            for (auto c = left_up_most[0]; c <= right_down_most[0]; c++) {
-                double p1, p2, p3;
-                p1 = radius[0] > 0 ?
-                    pow(((double) c - point[0])/radius[0], 2) : 0;
-                p2 = radius[1] > 0 ?
-                    pow(((double) r - point[1])/radius[1], 2) : 0;
-                p3 = radius[2] > 0 ?
-                    pow(((double) i - point[2])/radius[2], 2) : 0;
-                /* debug
-                cout << c << "-" << point[0] << ","
-                     << r << "-" << point[1] << ","
-                     << i << "-" << point[2] << "," << "\n\t";
-                cout << p1 << ","
-                     << p2 << ","
-                     << p3 << endl;
-                */
-                if (p1 + p2 + p3 <= 1.0) {
-                    point_set.push_back(Scalar(c, r, i));
-                }
-            }
-
-    int count = point_set.size();
-    Scalar avg = Scalar(.0, .0, .0);
-    // compute average
-    for (auto it = point_set.begin(); it != point_set.end(); ++it) {
-        Scalar pos = *it; // position of the pixel
-        Mat img = (*images)[pos[2]];
-        Vec3b pixel = img.at<Vec3b>(pos[1], pos[0]);
-        for (int channel = 0; channel < 3; channel++)
-            avg[channel] += pixel[channel];
+    // Scharr gradients in brightness channel, computed once per frame
+    shared_ptr<FrameGradient> grad =
+        images->gradients.get(frame, [&]() { return images->frame(frame); });
+    return grad->mag.at<float>(y, x);
+}
 
+Scalar cv_imgs_point_color_loc(ImgSeq *images, Point3i point,
+                               Scalar radius, int shape) {
+    if (shape == LOC_BOX) {
+        // bounding box of the local area
+        vector<Point3i> bounds = bound_scalar_3d(point, radius,
+                                                 images->bound());
+        Point3i left_up_most = bounds[0];
+        Point3i right_down_most = bounds[1];
+        Scalar sum, sqsum;
+        long count = cv_imgs_box_sums(images, left_up_most.x,
+                                      left_up_most.y, left_up_most.z,
+                                      right_down_most.x, right_down_most.y,
+                                      right_down_most.z, sum, sqsum);
+        if (count == 0)
+            return Scalar::all(NAN); // as an empty ellipsoid (0 / 0)
+        return sum/(double) count;
     }
     
+    // sum up pixels in the local ellipsoid
+    long count = 0;
+    Scalar avg = Scalar(.0, .0, .0);
+    stencil_apply(images, point, radius, [&](const uchar *px) {
+            for (int channel = 0; channel < 3; channel++)
+                avg[channel] += px[channel];
+            count++;
+        });
+
     avg = avg/(double) count;
     return avg;
 }
 
-vector<Scalar> cv_imgs_points_color_loc(vector<Mat> *images,
-                                        vector<Scalar> points,
-                                        Scalar radius) {
-    vector<Scalar> re;
-    for (auto it = points.begin(); it != points.end(); ++it)
-        re.push_back(cv_imgs_point_color_loc(images, (Scalar) *it, radius));
+vector<Scalar> cv_imgs_points_color_loc(ImgSeq *images,
+                                        const vector<Point3i> &points,
+                                        Scalar radius, int shape) {
+    vector<Scalar> re(points.size());
+    shared_pool()->parallel_for(points.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                re[i] = cv_imgs_point_color_loc(images, points[i], radius,
+                                                shape);
+        });
     return re;
 }
 
-vector<double> cv_imgs_points_var_loc(vector<Mat> *images,
-                                      vector<Scalar> points,
-                                      Scalar radius) {
-    vector<double> re;
-    for (auto it = points.begin(); it != points.end(); ++it)
-        re.push_back(cv_imgs_point_var_loc(images, (Scalar) *it, radius));
+vector<double> cv_imgs_points_var_loc(ImgSeq *images,
+                                      const vector<Point3i> &points,
+                                      Scalar radius, int shape) {
+    vector<double> re(points.size());
+    shared_pool()->parallel_for(points.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                re[i] = cv_imgs_point_var_loc(images, points[i], radius,
+                                              shape);
+        });
     return re;
 }
 
-vector<double> cv_imgs_points_scharr(vector<Mat> *images,
-                                     vector<Scalar> points) {
-    vector<double> re;
-    for (auto it = points.begin(); it != points.end(); ++it)
-        re.push_back(cv_imgs_point_scharr(images, (Scalar) *it));
+vector<double> cv_imgs_points_scharr(ImgSeq *images,
+                                     const vector<Point3i> &points) {
+    vector<double> re(points.size());
+    int w = images->width();
+    int h = images->height();
+    shared_pool()->parallel_for(points.size(), [&](size_t begin, size_t end) {
+            // gradient map of the current frame, points mostly share frames
+            shared_ptr<FrameGradient> grad;
+            int cur = -1;
+            for (size_t i = begin; i < end; i++) {
+                int x = points[i].x;
+                int y = points[i].y;
+                int frame = points[i].z;
+                if (x < 1 || y < 1 || x > w - 2 || y > h - 2) {
+                    re[i] = 0.0;
+                    continue;
+                }
+                if (!grad || frame != cur) {
+                    grad = images->gradients.get(frame, [&]() {
+                            return images->frame(frame);
+                        });
+                    cur = frame;
+                }
+                re[i] = grad->mag.at<float>(y, x);
+            }
+        });
     return re;
 }
 
-vector<Scalar> bound_scalar_3d(Scalar point, Scalar radius, Scalar bound) {
-    Scalar left_up_most(10000, 10000, 10000);
-    Scalar right_down_most(-10000, -10000, -10000);
+vector<Point3i> bound_scalar_3d(Point3i point, Scalar radius, Point3i bound) {
     // the order of Mat is "column, row, duration"
+    int p[3] = {point.x, point.y, point.z};
+    int b[3] = {bound.x, bound.y, bound.z};
+    int lu[3], rd[3];
     for (auto i = 0; i < 3; i++) {
-        left_up_most[i] = point[i] - radius[i] < 0 ? 0 : point[i] - radius[i];
-        right_down_most[i] = point[i] + radius[i] >= bound[i] ? bound[i] - 1 : point[i] + radius[i];
+        int r = radius[i];
+        lu[i] = p[i] - r < 0 ? 0 : p[i] - r;
+        rd[i] = p[i] + r >= b[i] ? b[i] - 1 : p[i] + r;
     }
-    vector<Scalar> re;
-    re.push_back(left_up_most);
-    re.push_back(right_down_most);
+    vector<Point3i> re;
+    re.push_back(Point3i(lu[0], lu[1], lu[2]));
+    re.push_back(Point3i(rd[0], rd[1], rd[2]));
     return re;
 }
 
-vector<Scalar> cv_line_pts_var_geq_T(vector<Mat> *images, Scalar point,
-                              Scalar direction, double var_threshold,
+vector<Point3i> cv_line_pts_var_geq_T(ImgSeq *images, Point3i point,
+                              Point3i direction, double var_threshold,
                               Scalar loc_radius){
-    vector<Scalar> re;
+    vector<Point3i> re;
     // size of the 3-d space
-    Scalar bound((*images)[0].cols, (*images)[0].rows, images->size());
+    Point3i bound = images->bound();
     // get all points on this line
-    vector<Scalar> line_points = get_line_points(point, direction, bound);
+    vector<Point3i> line_points = get_line_points(point, direction, bound);
     // evaluate local variance of all points
     for (auto it = line_points.begin(); it != line_points.end(); ++it) {
-        Scalar pt = *it;
+        Point3i pt = *it;
         double var =  cv_imgs_point_var_loc(images, pt, loc_radius);
         // debug
-        cout << (*it)[0] << ","
-             << (*it)[1] << ","
-             << (*it)[2] << "\t";
+        cout << pt.x << ","
+             << pt.y << ","
+             << pt.z << "\t";
         cout << var << endl;
         //
         if (var >= var_threshold)
@@ -452,22 +549,22 @@ vector<Scalar> cv_line_pts_var_geq_T(vector<Mat> *images, Scalar point,
     return re;
 }
 
-vector<Scalar> cv_line_seg_pts_var_geq_T(vector<Mat> *images, Scalar start,
-                              Scalar end, double var_threshold,
+vector<Point3i> cv_line_seg_pts_var_geq_T(ImgSeq *images, Point3i start,
+                              Point3i end, double var_threshold,
                               Scalar loc_radius){
-    vector<Scalar> re;
+    vector<Point3i> re;
     // size of the 3-d space
-    Scalar bound((*images)[0].cols, (*images)[0].rows, images->size());
+    Point3i bound = images->bound();
     // get all points on this line
-    vector<Scalar> line_points = get_line_seg_points(start, end, bound);
+    vector<Point3i> line_points = get_line_seg_points(start, end, bound);
     // evaluate local variance of all points
     for (auto it = line_points.begin(); it != line_points.end(); ++it) {
-        Scalar pt = *it;
+        Point3i pt = *it;
         double var =  cv_imgs_point_var_loc(images, pt, loc_radius);
         /* debug
-        cout << (*it)[0] << ","
-             << (*it)[1] << ","
-             << (*it)[2] << "\t";
+        cout << pt.x << ","
+             << pt.y << ","
+             << pt.z << "\t";
         cout << var << endl;
         */
         if (var >= var_threshold)
@@ -477,388 +574,392 @@ vector<Scalar> cv_line_seg_pts_var_geq_T(vector<Mat> *images, Scalar start,
 }
 
 // 3D Bresenham's line generation
-vector<Scalar> get_line_points(Scalar point, Scalar direction,
-                               Scalar bound) {
+vector<Point3i> get_line_points(Point3i point, Point3i direction,
+                                Point3i bound) {
     // REMARK: all coordinate oders as "column, row, duration"
-    vector<Scalar> re; // returned point list
+    vector<Point3i> re; // returned point list
 
-    if (direction[0] == 0 &&
-        direction[1] == 0 &&
-        direction[2] == 0)
+    if (direction.x == 0 &&
+        direction.y == 0 &&
+        direction.z == 0)
         return re;
     
     // increment in each direction
-    int c_inc = direction[0] > 0 ? 1 : -1;
-    int r_inc = direction[1] > 0 ? 1 : -1;
-    int d_inc = direction[2] > 0 ? 1 : -1;
-    Scalar inc;
-    inc[0] = c_inc;
-    inc[1] = r_inc;
-    inc[2] = d_inc;
-    bresenham(point, direction, inc, bound, &re);
-
+    Point3i inc(direction.x > 0 ? 1 : -1,
+                direction.y > 0 ? 1 : -1,
+                direction.z > 0 ? 1 : -1);
+    // grow against the direction first, so only this half is reversed
+    bresenham(point, direction, -inc, bound, &re);
     reverse(re.begin(), re.end());
-    re.push_back(point); // insert itself
-    // grow in another direction
-    c_inc = -1 * c_inc;
-    r_inc = -1 * r_inc;
-    d_inc = -1 * d_inc;
-    inc[0] = c_inc;
-    inc[1] = r_inc;
-    inc[2] = d_inc;
+    re.push_back(point); // insert itself, even if it is outside
     bresenham(point, direction, inc, bound, &re);
-    reverse(re.begin(), re.end());
 
     return re;
 }
 
-vector<Scalar> get_line_seg_points(Scalar start, Scalar end, Scalar bound) {
-    vector<Scalar> re; // returned point list
-    
-    int x = start[0];
-    int y = start[1];
-    int z = start[2];
-    int x2 = end[0];
-    int y2 = end[1];
-    int z2 = end[2];
-
-    if (x == x2 &&
-        y == y2 &&
-        z == z2)
+vector<Point3i> get_line_seg_points(Point3i start, Point3i end,
+                                    Point3i bound) {
+    vector<Point3i> re; // returned point list
+    if (start == end)
         return re;
-    // boundary check
-    if (out_of_canvas(start, bound) && out_of_canvas(end, bound))
-        return re;
-    if (out_of_canvas(start, bound) && !out_of_canvas(end, bound)) {
-        // if start point is out of canvas and end point is in the canvas,
-        // swap the start and the end point
-        SWAP(x, x2);
-        SWAP(y, y2);
-        SWAP(z, z2);
-    }
-    
-    re.push_back(Scalar(x, y, z));
-    // bresenham for line segment
-    int dx = x2 - x;
-    int dy = y2 - y;
-    int dz = z2 - z;
-
-    int x_inc = dx > 0 ? 1 : -1;
-    int y_inc = dy > 0 ? 1 : -1;
-    int z_inc = dz > 0 ? 1 : -1;
-
-    int Adx = abs(dx);
-    int Ady = abs(dy);
-    int Adz = abs(dz);
-    
-    int dx2 = Adx*2;
-    int dy2 = Ady*2;
-    int dz2 = Adz*2;
-
-    int err_1, err_2;
-
-    while (!out_of_canvas(Scalar(x, y, z), bound) &&
-           !(x == x2 && y == y2 && z == z2)) {
-        if (Adx >= Ady && Adx >= Adz) {
-            err_1 = dy2 - Adx;
-            err_2 = dz2 - Adx;
-            for (int cont = 0; cont < Adx; cont++) {
-                if (err_1 > 0) { 
-                    y += y_inc;
-                    err_1 -= dx2;
-                }
-                if (err_2 > 0) {
-                    z += z_inc;
-                    err_2 -= dx2;
+    // the segment is the first period of the line from start to end
+    Point3i delta = end - start;
+    Point3i inc(delta.x > 0 ? 1 : -1,
+                delta.y > 0 ? 1 : -1,
+                delta.z > 0 ? 1 : -1);
+    long long k0 = 0;
+    long long k1 = max(abs(delta.x), max(abs(delta.y), abs(delta.z)));
+    if (clip_digital_line(start, delta, inc, bound, k0, k1))
+        digital_line(start, delta, inc, k0, k1, &re);
+    return re;
+}
+
+void cv_sample_lines(ImgSeq *images,
+                     const vector<pair<Point3i, Point3i> > &lines, bool segs,
+                     int kind, bool parallel,
+                     vector<vector<Point3i> > &points,
+                     vector<vector<double> > &values) {
+    size_t n = lines.size();
+    points.assign(n, vector<Point3i>());
+    values.assign(n, vector<double>());
+    Point3i bound = images->bound();
+    int w = images->width();
+    int h = images->height();
+    auto sample = [&](size_t begin, size_t end) {
+        // gradient map of the current frame, kept across the lines
+        shared_ptr<FrameGradient> grad;
+        int cur = -1;
+        for (size_t i = begin; i < end; i++) {
+            points[i] = segs
+                ? get_line_seg_points(lines[i].first, lines[i].second, bound)
+                : get_line_points(lines[i].first, lines[i].second, bound);
+            const vector<Point3i> &pts = points[i];
+            vector<double> &vals = values[i];
+            vals.resize(kind == LINE_COLOR ? 3 * pts.size() : pts.size());
+            for (size_t j = 0; j < pts.size(); j++) {
+                if (kind == LINE_COLOR) {
+                    Scalar color = cv_imgs_point_color_loc(images, pts[j],
+                                                           Scalar(0, 0, 0));
+                    for (int c = 0; c < 3; c++)
+                        vals[3 * j + c] = color[c];
+                } else if (kind == LINE_VAR) {
+                    vals[j] = cv_imgs_point_var_loc(images, pts[j]);
+                } else {
+                    int x = pts[j].x, y = pts[j].y, frame = pts[j].z;
+                    if (x < 1 || y < 1 || x > w - 2 || y > h - 2) {
+                        vals[j] = 0.0;
+                        continue;
+                    }
+                    if (!grad || frame != cur) {
+                        grad = images->gradients.get(frame, [&]() {
+                                return images->frame(frame);
+                            });
+                        cur = frame;
+                    }
+                    vals[j] = grad->mag.at<float>(y, x);
                 }
-                err_1 += dy2;
-                err_2 += dz2;
-                x += x_inc;
-                Scalar point(x, y, z);
-                if (!out_of_canvas(point, bound) &&
-                    !(x == x2 && y == y2 && z == z2))
-                    re.push_back(point);
-                else
-                    break;
             }
         }
-        
-        if (Ady > Adx && Ady >= Adz) {
-            err_1 = dx2 - Ady;
-            err_2 = dz2 - Ady;
-            for (int cont = 0; cont < Ady; cont++) {
-                if (err_1 > 0) {
-                    x += x_inc;
-                    err_1 -= dy2;
-                }
-                if (err_2 > 0) { 
-                    z += z_inc;
-                    err_2 -= dy2;
-                }
-                err_1 += dx2;
-                err_2 += dz2;
-                y += y_inc;
-                Scalar point(x, y, z);
-                if (!out_of_canvas(point, bound) &&
-                    !(x == x2 && y == y2 && z == z2))
-                    re.push_back(point);
-                else
-                    break;
-            }
+    };
+    if (parallel)
+        shared_pool()->parallel_for(n, sample, 4, 1);
+    else
+        sample(0, n);
+}
+
+/* bresenham for line, NOT segment */
+void bresenham(Point3i current, Point3i direction, Point3i inc,
+               Point3i bound, vector<Point3i> *points) {
+    long long k0 = 1; // the current point itself is not appended
+    long long k1 = LLONG_MAX;
+    // the walk stops at its first step outside, so it only continues if
+    // the first step is inside
+    if (clip_digital_line(current, direction, inc, bound, k0, k1) &&
+        k0 == 1)
+        digital_line(current, direction, inc, k0, k1, points);
+}
+
+/* major axis of a digital line, ties are broken in order x, y, z */
+int major_axis(const long long a[3]) {
+    if (a[0] >= a[1] && a[0] >= a[2])
+        return 0;
+    if (a[1] > a[0] && a[1] >= a[2])
+        return 1;
+    return 2;
+}
+
+/* number of moves along a minor axis after k steps along the major axis,
+ *     a_i and a_m are the lengths of the direction on both axes
+ */
+inline long long bresenham_moves(long long k, long long a_i,
+                                 long long a_m) {
+    return (2 * k * a_i + a_m - 1) / (2 * a_m);
+}
+
+bool clip_digital_line(Point3i from, Point3i delta, Point3i inc,
+                       Point3i bound, long long &k0, long long &k1) {
+    long long p[3] = {from.x, from.y, from.z};
+    long long a[3] = {abs(delta.x), abs(delta.y), abs(delta.z)};
+    long long s[3] = {inc.x, inc.y, inc.z};
+    long long b[3] = {bound.x, bound.y, bound.z};
+    int m = major_axis(a);
+    if (a[m] == 0)
+        return false;
+    for (int i = 0; i < 3; i++) {
+        // moves along axis i must be in [lo, hi] to stay in [0, b - 1]
+        long long lo = s[i] > 0 ? -p[i] : p[i] - (b[i] - 1);
+        long long hi = s[i] > 0 ? b[i] - 1 - p[i] : p[i];
+        if (hi < 0)
+            return false;
+        if (i == m) { // one move per step
+            k0 = max(k0, lo);
+            k1 = min(k1, hi);
+            continue;
         }
-        
-        if (Adz > Adx && Adz > Ady) {
-            err_1 = dy2 - Adz;
-            err_2 = dx2 - Adz;
-            for (int cont = 0; cont < Adz; cont++) {
-                if (err_1 > 0) {
-                    y += y_inc;
-                    err_1 -= dz2;
-                }
-                if (err_2 > 0) {
-                    x += x_inc;
-                    err_2 -= dz2;
-                }
-                err_1 += dy2;
-                err_2 += dx2;
-                z += z_inc;
-                Scalar point(x, y, z);
-                if (!out_of_canvas(point, bound) &&
-                    !(x == x2 && y == y2 && z == z2))
-                    re.push_back(point);
-                else
-                    break;
-            }
+        // solve bresenham_moves(k) >= lo and bresenham_moves(k) <= hi
+        if (lo > 0) {
+            if (a[i] == 0)
+                return false;
+            long long num = 2 * a[m] * lo - a[m] + 1;
+            k0 = max(k0, (num + 2 * a[i] - 1) / (2 * a[i]));
         }
+        if (a[i] > 0)
+            k1 = min(k1, (2 * a[m] * hi + a[m]) / (2 * a[i]));
     }
-    re.push_back(Scalar(x2, y2, z2));
-    return re;
+    return k0 <= k1;
 }
-/* bresenham for line, NOT segment */
-void bresenham(Scalar current, Scalar direction, Scalar inc,
-               Scalar bound, vector<Scalar> *points) {
-    // direction
-    int dx = direction[0];
-    int dy = direction[1];
-    int dz = direction[2];
-    
-    int x_inc = inc[0];
-    int y_inc = inc[1];
-    int z_inc = inc[2];
-    
-    int Adx = abs(dx);
-    int Ady = abs(dy);
-    int Adz = abs(dz);
-    
-    int dx2 = Adx*2;
-    int dy2 = Ady*2;
-    int dz2 = Adz*2;
-    
-    int x = current[0];
-    int y = current[1];
-    int z = current[2];
 
-    int err_1, err_2;
-    
-    if (Adx >= Ady && Adx >= Adz) { 
-        err_1 = dy2 - Adx;
-        err_2 = dz2 - Adx;
-        for (int cont = 0; cont < Adx; cont++) {
-            if (err_1 > 0) { 
-                y += y_inc;
-                err_1 -= dx2;
-            }
-            if (err_2 > 0) {
-                z += z_inc;
-                err_2 -= dx2;
+void digital_line(Point3i from, Point3i delta, Point3i inc,
+                  long long k0, long long k1, vector<Point3i> *points) {
+    long long p[3] = {from.x, from.y, from.z};
+    long long a[3] = {abs(delta.x), abs(delta.y), abs(delta.z)};
+    long long s[3] = {inc.x, inc.y, inc.z};
+    int m = major_axis(a);
+    int i1 = (m + 1) % 3, i2 = (m + 2) % 3; // minor axes
+    // jump to point k0: position and error terms after k0 steps
+    int q[3];
+    long long err[3];
+    q[m] = p[m] + s[m] * k0;
+    for (int i : {i1, i2}) {
+        long long moves = bresenham_moves(k0, a[i], a[m]);
+        q[i] = p[i] + s[i] * moves;
+        err[i] = 2 * a[i] - a[m] + 2 * k0 * a[i] - 2 * a[m] * moves;
+    }
+    points->reserve(points->size() + (k1 - k0 + 1));
+    points->push_back(Point3i(q[0], q[1], q[2]));
+    for (long long k = k0 + 1; k <= k1; k++) {
+        for (int i : {i1, i2}) {
+            if (err[i] > 0) {
+                q[i] += s[i];
+                err[i] -= 2 * a[m];
             }
-            err_1 += dy2;
-            err_2 += dz2;
-            x += x_inc;
-            Scalar point(x, y, z);
-            if (!out_of_canvas(point, bound))
-                points->push_back(point);
-            else
-                break;
+            err[i] += 2 * a[i];
         }
+        q[m] += s[m];
+        points->push_back(Point3i(q[0], q[1], q[2]));
     }
-    
-    if (Ady > Adx && Ady >= Adz) {
-        err_1 = dx2 - Ady;
-        err_2 = dz2 - Ady;
-        for (int cont = 0; cont < Ady; cont++) {
-            if (err_1 > 0) {
-                x += x_inc;
-                err_1 -= dy2;
-            }
-            if (err_2 > 0) { 
-                z += z_inc;
-                err_2 -= dy2;
-            }
-            err_1 += dx2;
-            err_2 += dz2;
-            y += y_inc;
-            Scalar point(x, y, z);
-            if (!out_of_canvas(point, bound))
-                points->push_back(point);
-            else
-                break;
-            
+}
+
+Point3i digital_line_point(Point3i from, Point3i delta, Point3i inc,
+                           long long k) {
+    long long p[3] = {from.x, from.y, from.z};
+    long long a[3] = {abs(delta.x), abs(delta.y), abs(delta.z)};
+    long long s[3] = {inc.x, inc.y, inc.z};
+    int m = major_axis(a);
+    long long q[3];
+    for (int i = 0; i < 3; i++)
+        q[i] = p[i] + s[i] * (i == m ? k : bresenham_moves(k, a[i], a[m]));
+    return Point3i(q[0], q[1], q[2]);
+}
+
+// real roots of x^3 + c2 x^2 + c1 x + c0 = 0, returns their number
+int solve_cubic(double c2, double c1, double c0, double roots[3]) {
+    // depressed cubic t^3 + p t + q = 0, x = t - c2 / 3
+    double shift = -c2 / 3;
+    double p = c1 - c2 * c2 / 3;
+    double q = 2 * c2 * c2 * c2 / 27 - c2 * c1 / 3 + c0;
+    double disc = q * q / 4 + p * p * p / 27;
+    if (disc > 0 || p == 0) { // one real root
+        double s = sqrt(max(disc, 0.0));
+        roots[0] = cbrt(-q / 2 + s) + cbrt(-q / 2 - s) + shift;
+        return 1;
+    }
+    // three real roots, trigonometric solution
+    double r = 2 * sqrt(-p / 3);
+    double phi = acos(max(-1.0, min(1.0, 3 * q / (p * r))));
+    for (int k = 0; k < 3; k++)
+        roots[k] = r * cos((phi - 2 * CV_PI * k) / 3) + shift;
+    return 3;
+}
+
+// eigenvector of m for eigenvalue lambda, i.e. the longest cross product
+// of two rows of m - lambda * I
+Vec3d eigen_vector_3(const Matx33d &m, double lambda) {
+    Matx33d a = m;
+    for (int i = 0; i < 3; i++)
+        a(i, i) -= lambda;
+    Vec3d best(0, 0, 0);
+    double best_norm = -1;
+    for (int i = 0; i < 3; i++) {
+        int r1 = (i + 1) % 3, r2 = (i + 2) % 3;
+        Vec3d v(a(r1, 1) * a(r2, 2) - a(r1, 2) * a(r2, 1),
+                a(r1, 2) * a(r2, 0) - a(r1, 0) * a(r2, 2),
+                a(r1, 0) * a(r2, 1) - a(r1, 1) * a(r2, 0));
+        double norm = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+        if (norm > best_norm) {
+            best_norm = norm;
+            best = v;
         }
     }
-   
-    if (Adz > Adx && Adz > Ady) {
-        err_1 = dy2 - Adz;
-        err_2 = dx2 - Adz;
-        for (int cont = 0; cont < Adz; cont++) {
-            if (err_1 > 0) {
-                y += y_inc;
-                err_1 -= dz2;
-            }
-            if (err_2 > 0) {
-                x += x_inc;
-                err_2 -= dz2;
+    return best;
+}
+
+bool fit_ellipse(const vector<Point3i> &points, Point3i &centre,
+                 Scalar &param) {
+    size_t n = points.size();
+    if (n < 5) // must use more than 5 points
+        return false;
+    int frame = points[0].z;
+    // normalize the points into [-1, 1] around the centre of their box
+    int min_x = INT_MAX, max_x = INT_MIN, min_y = INT_MAX, max_y = INT_MIN;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        min_x = min(min_x, it->x);
+        max_x = max(max_x, it->x);
+        min_y = min(min_y, it->y);
+        max_y = max(max_y, it->y);
+    }
+    double ox = (min_x + (double) max_x) / 2;
+    double oy = (min_y + (double) max_y) / 2;
+    double scale = max(max_x - (double) min_x, max_y - (double) min_y) / 2;
+    if (scale <= 0)
+        return false;
+    // scatter matrices S1 = D1^T D1, S2 = D1^T D2 and S3 = D2^T D2 of the
+    // quadratic part D1 = (x^2, xy, y^2) and linear part D2 = (x, y, 1)
+    Matx33d S1, S2, S3;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        double x = (it->x - ox) / scale;
+        double y = (it->y - oy) / scale;
+        double d1[3] = {x * x, x * y, y * y};
+        double d2[3] = {x, y, 1};
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++) {
+                S1(i, j) += d1[i] * d1[j];
+                S2(i, j) += d1[i] * d2[j];
+                S3(i, j) += d2[i] * d2[j];
             }
-            err_1 += dy2;
-            err_2 += dx2;
-            z += z_inc;
-            Scalar point(x, y, z);
-            if (!out_of_canvas(point, bound))
-                points->push_back(point);
-            else
-                break;
-        }
     }
-    
-    Scalar point(x, y, z);
-    if (!out_of_canvas(point, bound))
-        bresenham(point, direction, inc, bound, points);
-}
-
-void fit_ellipse(vector<Scalar> points, Scalar& centre, Scalar& param) {
-    assert(points.size() >= 5); // must use more than 5 points
-    int frame = points[0][2];
-    arma::mat pts(points.size(), 2);
-    for (arma::uword i = 0; i < points.size(); i++) {
-        arma::rowvec p = {(double) points[i][0], (double) points[i][1]};
-        pts.row(i) = p;
+    // S3 is singular iff the points are collinear
+    if (fabs(determinant(S3)) < 1e-10 * n * n * n)
+        return false;
+    // linear coefficients a2 = T a1 of the quadratic ones a1
+    Matx33d T = -(S3.inv() * S2.t());
+    Matx33d M = S1 + S2 * T;
+    // M premultiplied by the inverse of the constraint matrix
+    // C1 = [0 0 2; 0 -1 0; 2 0 0] (4ac - b^2 = 1)
+    Matx33d R(M(2, 0) / 2, M(2, 1) / 2, M(2, 2) / 2,
+              -M(1, 0), -M(1, 1), -M(1, 2),
+              M(0, 0) / 2, M(0, 1) / 2, M(0, 2) / 2);
+    // eigenvalues from the characteristic polynomial of R
+    double tr = R(0, 0) + R(1, 1) + R(2, 2);
+    double minors = R(0, 0) * R(1, 1) - R(0, 1) * R(1, 0)
+        + R(0, 0) * R(2, 2) - R(0, 2) * R(2, 0)
+        + R(1, 1) * R(2, 2) - R(1, 2) * R(2, 1);
+    double roots[3];
+    int n_roots = solve_cubic(-tr, minors, -determinant(R), roots);
+    // the eigenvector of an ellipse (4ac - b^2 > 0)
+    Vec3d a1;
+    double best = 0;
+    for (int i = 0; i < n_roots; i++) {
+        Vec3d v = eigen_vector_3(R, roots[i]);
+        double norm = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+        double cond = (4 * v[0] * v[2] - v[1] * v[1]) / norm;
+        if (norm > 0 && cond > best) {
+            best = cond;
+            a1 = v;
+        }
     }
-    arma::vec x = pts.col(0);
-    arma::vec y = pts.col(1);
-    // get matrix D = (x^2, xy, y^2, x, y, 1)
-    arma::mat D(x.size(), 6);
-    D.col(0) = x % x;
-    D.col(1) = x % y;
-    D.col(2) = y % y;
-    D.col(3) = x;
-    D.col(4) = y;
-    D.col(5) = arma::vec(x.size(), arma::fill::ones);
-    // S = D^T * D
-    arma::mat S = D.t() * D;
-    // C is a matrix filled with zeros except C_{3,1}=C_{1,3}=2, C_{1,1}=-1
-    arma::mat C(6, 6, arma::fill::zeros);
-    C(0, 2) = 2;
-    C(2, 0) = 2;
-    C(1, 1) = -1;
-    // solve eigen decomposition
-    arma::cx_vec eigval;
-    arma::cx_mat eigvec;
-    arma::eig_gen(eigval, eigvec, inv(S) * C);
-    // get largest eigen value and vector
-    arma::uword n;
-    (arma::abs(real(eigval))).max(n);
-    // a is parameter of the ellipse equation axx, axy, ayy, ax, ay, a1
-    arma::vec a_vec = real(eigvec.col(n));
-    // transform a into other parameters
-    double b = a_vec[1] / 2;
-    double c = a_vec[2];
-    double d = a_vec[3] / 2; 
-    double f = a_vec[4] / 2;
-    double g = a_vec[5];
-    double a = a_vec[0];
-    double num = b * b - a * c;
-    int x0 = int((c * d - b * f) / num);
-    int y0 = int((a * f - b * d) / num);
-    centre = Scalar(x0, y0, frame); // centre of ellipse
-    double up = 2*(a * f * f + c * d * d + g * b * b
-                   - 2 * b * d * f - a * c * g);
-    double down1 = (b * b - a * c) *
-        ((c - a) * sqrt(1 + 4 * b * b / ((a - c) * (a - c))) - (c + a));
-    double down2 = (b * b - a * c) *
-        ((a - c) * sqrt(1 + 4 * b * b / ((a - c) * (a - c))) - (c + a));
-    double res1 = sqrt(up / down1); // axis length
-    double res2 = sqrt(up / down2); // axis length
-    double angle; // angle of ellipse
-    if (b == 0)
-        if (a > c)
-            angle = 0;
-        else
-            angle = arma::datum::pi/2;
-    else
-        if (a > c)
-            angle = atan(2 * b / (a - c)) / 2;
-        else
-            angle = arma::datum::pi/2 + atan(2 * b / (a - c)) / 2;
+    if (best <= 0)
+        return false;
+    if (a1[0] + a1[2] < 0) // positive definite quadratic part
+        a1 = Vec3d(-a1[0], -a1[1], -a1[2]);
+    Vec3d a2 = T * a1;
+    // ellipse a x^2 + 2b xy + c y^2 + 2d x + 2f y + g = 0
+    double a = a1[0];
+    double b = a1[1] / 2;
+    double c = a1[2];
+    double d = a2[0] / 2;
+    double f = a2[1] / 2;
+    double g = a2[2];
+    double num = b * b - a * c; // < 0 for ellipses
+    double x0 = (c * d - b * f) / num;
+    double y0 = (a * f - b * d) / num;
+    // the value at the centre and eigenvalues of the quadratic form give
+    // the axes
+    double g0 = d * x0 + f * y0 + g;
+    double h = sqrt((a - c) * (a - c) / 4 + b * b);
+    double r1 = -g0 / ((a + c) / 2 + h);
+    double r2 = -g0 / ((a + c) / 2 - h);
+    if (!(r1 > 0 && r2 > 0))
+        return false;
+    r1 = sqrt(r1) * scale; // axis length
+    r2 = sqrt(r2) * scale;
+    centre = Point3i(cvRound(ox + x0 * scale), cvRound(oy + y0 * scale),
+                     frame); // centre of ellipse
+    // angle of the short axis (eigenvector of the larger eigenvalue), as
+    // the rotation of the first (shorter) axis in OpenCV ellipses
+    double angle = atan2(2 * b, a - c) / 2 * 180 / CV_PI;
+    angle = fmod(round(angle) + 180, 180);
     // save parameters
-    angle = 90 + (angle * 180/arma::datum::pi); // readjust "angle" to OpenCV radius axis
-    if (res1 >= res2)
-        param = Scalar(round(res1), round(res2), round(angle));
-    else
-        param = Scalar(round(res2), round(res1), round(angle));
-}
-
-vector<Scalar> get_ellipse_points(Scalar centre, Scalar param, Scalar bound) {
-    vector<Scalar> re;
-    // detailness of using polylines to approximate ellipse
-    int width = std::abs((int) param[0]);
-    int height = std::abs((int) param[1]);
-    if (width > height)
-        SWAP(width, height);
-
-    std::vector<Point> v; // vertices
-    //cout << "Starting OpenCV ellipse2Poly.\n";
-    ellipse2Poly(Point(centre[0], centre[1]),
-                 Size(width, height),
-                 param[2], 0, 360, 3, v); // the "3" before "v" is a parameter to control the accuracy of the polygon-approximation to ellipse
-    if((int) v.size() <= 0)
+    param = Scalar(round(max(r1, r2)), round(min(r1, r2)), angle);
+    return true;
+}
+
+vector<char> fit_ellipses(const vector<vector<Point3i> > &sets,
+                          vector<Point3i> &centres, vector<Scalar> &params) {
+    vector<char> fitted(sets.size(), 0);
+    centres.assign(sets.size(), Point3i(0, 0, 0));
+    params.assign(sets.size(), Scalar(0, 0, 0));
+    // a set is much more work than a point, shorter loops are parallel
+    shared_pool()->parallel_for(sets.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                fitted[i] = fit_ellipse(sets[i], centres[i], params[i]);
+        }, PARALLEL_MIN_ITEMS / 16, PARALLEL_MIN_CHUNK / 16);
+    return fitted;
+}
+
+vector<Point3i> get_ellipse_points(Point3i centre, Scalar param,
+                                   Point3i bound) {
+    vector<Point3i> re;
+    if (centre.z < 0 || centre.z >= bound.z)
         return re;
-    //cout << "OpenCV ellipse2Poly done.\n";
-    //cout << "Totally " << v.size() << " vertices.\n";
-
-    Point p0;
-    p0 = v[0];
-    //cout << "Starting polygon to line segment points.\n";
-    for(int i = 1; i < (int) v.size(); i++) {
-        //cout << "converting point #" << i;
-        Point p = v[i];
-        //cout << " (" << p.x << ", " << p.y << ")";
-        // points on line segment
-        vector<Scalar> temp_pts = get_line_seg_points(Scalar(p0.x, p0.y, centre[2]), Scalar(p.x, p.y, centre[2]), bound);
-        re += temp_pts;
-        //cout << ". Points num: " << temp_pts.size() << endl;;
-        p0 = p;
+    // contour around the origin, cached by shape
+    shared_ptr<const vector<Point> > contour = get_ellipse_contour(param);
+    re.reserve(contour->size());
+    for (auto it = contour->begin(); it != contour->end(); ++it) {
+        Point3i pt(centre.x + it->x, centre.y + it->y, centre.z);
+        if (pt.x >= 0 && pt.x < bound.x && pt.y >= 0 && pt.y < bound.y)
+            re.push_back(pt);
     }
-    //cout << "polygon to line segment points done.\n";
     return re;
 }
 
-vector<Scalar> cv_line_pts_scharr_geq_T(vector<Mat> *images,
-                                        Scalar point,
-                                        Scalar direction,
+vector<Point3i> cv_line_pts_scharr_geq_T(ImgSeq *images,
+                                         Point3i point,
+                                         Point3i direction,
                                         double grad_threshold) {
-    vector<Scalar> re;
+    vector<Point3i> re;
     // size of the 3-d space
-    Scalar bound((*images)[0].cols, (*images)[0].rows, images->size());
+    Point3i bound = images->bound();
     // get all points on this line
-    vector<Scalar> line_points = get_line_points(point, direction, bound);
-    re.push_back((Scalar) *(line_points.begin()));
+    vector<Point3i> line_points = get_line_points(point, direction, bound);
+    re.push_back(line_points.front());
     // evaluate Scharr gradients of all points
-    Scalar tmp_last; // temporary last point
-    Scalar tmp_max; // max gradient point
+    Point3i tmp_last; // temporary last point
+    Point3i tmp_max; // max gradient point
     double tmp_g; // max gradient intensity
     bool cont = false; // flag of continuous component existence
     for (auto it = line_points.begin(); it != line_points.end(); ++it) {
-        Scalar pt = *it;
+        Point3i pt = *it;
         double grad = cv_imgs_point_scharr(images, pt);
         if (grad >= grad_threshold) {
             if (!cont) {
@@ -881,27 +982,27 @@ vector<Scalar> cv_line_pts_scharr_geq_T(vector<Mat> *images,
             }
         }
     }
-    re.push_back((Scalar) *line_points.rbegin());
+    re.push_back(line_points.back());
     return re;
 }
 
-vector<Scalar> cv_line_seg_pts_scharr_geq_T(vector<Mat> *images,
-                                            Scalar start,
-                                            Scalar end,
+vector<Point3i> cv_line_seg_pts_scharr_geq_T(ImgSeq *images,
+                                             Point3i start,
+                                             Point3i end,
                                             double grad_threshold) {
-    vector<Scalar> re;
+    vector<Point3i> re;
     // size of the 3-d space
-    Scalar bound((*images)[0].cols, (*images)[0].rows, images->size());
+    Point3i bound = images->bound();
     // get all points on this line
-    vector<Scalar> line_points = get_line_seg_points(start, end, bound);
-    re.push_back((Scalar) *(line_points.begin()));
+    vector<Point3i> line_points = get_line_seg_points(start, end, bound);
+    re.push_back(line_points.front());
     // evaluate Scharr gradients of all points
-    Scalar tmp_last;
-    Scalar tmp_max;
+    Point3i tmp_last;
+    Point3i tmp_max;
     double tmp_g;
     bool cont = false; // flag of continuous component existence    
     for (auto it = line_points.begin(); it != line_points.end(); ++it) {
-        Scalar pt = *it;
+        Point3i pt = *it;
         double grad = cv_imgs_point_scharr(images, pt);
 
         if (grad >= grad_threshold) {
@@ -925,81 +1026,112 @@ vector<Scalar> cv_line_seg_pts_scharr_geq_T(vector<Mat> *images,
             }
         }
     }
-    re.push_back((Scalar) *line_points.rbegin());
+    re.push_back(line_points.back());
     return re;
 }
 
-double compare_hist(vector<Mat> *images,
-                    vector<Scalar> points_1,
-                    vector<Scalar> points_2) {
-    // get colors
-    vector<Scalar> colors_1;
-    vector<Scalar> colors_2;
-    for (auto it = points_1.begin(); it != points_1.end(); ++it)
-        colors_1.push_back(cv_imgs_point_color_loc(images, (Scalar) *it,
-                                                   Scalar(0, 0, 0)));
-    for (auto it = points_2.begin(); it != points_2.end(); ++it)
-        colors_2.push_back(cv_imgs_point_color_loc(images, (Scalar) *it,
-                                                   Scalar(0, 0, 0)));
-    // calculate histogram
-    /* cout << "pts1:" << endl; */
-    arma::Mat<int> freq_1(3, 32, arma::fill::zeros); // frequency
-    arma::Mat<int> freq_2(3, 32, arma::fill::zeros);
-    for (auto it = colors_1.begin(); it != colors_1.end(); ++it) {
-        Scalar lab = *it;
-        for (int channel = 0; channel < 3; channel++) {
-            int f = lab[channel]/8;
-            /*
-            cout << channel << " .. "
-                 << lab[channel] << " ~= " 
-                 << f << endl;
-            */
-            freq_1(channel, f) = freq_1(channel, f) + 1;
+void hist_add_points(ImgSeq *images, const vector<Point3i> &points,
+                     ColorHist &hist) {
+    Point3i bound = images->bound();
+    Mat img;
+    int frame = -1;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        if (out_of_canvas(*it, bound))
+            continue;
+        if (it->z != frame) {
+            frame = it->z;
+            img = images->frame(frame);
         }
+        int ch = img.channels();
+        const uchar *px = img.ptr<uchar>(it->y) + it->x * ch;
+        for (int c = 0; c < 3; c++)
+            hist.freq[c][c < ch ? px[c] >> 3 : 0]++;
+        hist.n++;
     }
-    /* cout << "pts2:" << endl; */
-    for (auto it = colors_2.begin(); it != colors_2.end(); ++it) {
-        Scalar lab = *it;
-        for (int channel = 0; channel < 3; channel++) {
-            int f = lab[channel]/8;
-            /*
-            cout << channel << " .. "
-                 << lab[channel] << " ~= " 
-                 << f << endl;
-            */
-            freq_2(channel, f) = freq_2(channel, f) + 1;
-        }
-    }
-    arma::mat hist_1(3, 32, arma::fill::zeros); // histogram
-    arma::mat hist_2(3, 32, arma::fill::zeros);
-    /* cout << "frequencies: " << endl; */
-    for (int f = 0; f < 32; f++) {
-        for (int ch = 0; ch < 3; ch++) {
-            /* cout << freq_1(ch, f) << "/" << freq_2(ch, f) << ", "; */
-            // smooth the distribution with Dirichlet prior
-            hist_1(ch, f) =
-                (freq_1(ch, f) + 0.0001)/(arma::sum(freq_1.row(ch)) + 0.0032);
-            hist_2(ch, f) =
-                (freq_2(ch, f) + 0.0001)/(arma::sum(freq_2.row(ch)) + 0.0032);
-        }
-        /* cout << endl; */
-    }
-    // calculate KL divergence
-    Scalar kls(0.0, 0.0, 0.0);
+}
+
+void hist_add_rect(ImgSeq *images, int z, Rect rect, ColorHist &hist) {
+    if (z < 0 || z >= images->depth())
+        return;
+    shared_ptr<FrameHistogram> fh =
+        images->histograms.get(z, [&]() { return images->frame(z); });
+    fh->add_rect(rect, hist);
+}
+
+double hist_distance(const ColorHist &hist_1, const ColorHist &hist_2) {
+    // each pixel counts once in every channel, so n is the sum of a row
+    double sum_1 = hist_1.n + 0.0001 * HIST_BINS;
+    double sum_2 = hist_2.n + 0.0001 * HIST_BINS;
+    double kls[3];
     for (int ch = 0; ch < 3; ch++) {
         double D_1_2 = 0;
         double D_2_1 = 0;
-        for (int f = 0; f < 32; f++) {
-            D_1_2 += hist_1(ch, f)*log2(hist_1(ch, f)/hist_2(ch, f));
-            D_2_1 += hist_2(ch, f)*log2(hist_2(ch, f)/hist_1(ch, f));
+        for (int f = 0; f < HIST_BINS; f++) {
+            // smooth the distribution with Dirichlet prior
+            double p_1 = (hist_1.freq[ch][f] + 0.0001) / sum_1;
+            double p_2 = (hist_2.freq[ch][f] + 0.0001) / sum_2;
+            double log_ratio = log2(p_1 / p_2);
+            D_1_2 += p_1 * log_ratio;
+            D_2_1 -= p_2 * log_ratio;
         }
-        kls[ch] = (D_1_2 + D_2_1)/2;
-        /* cout << kls[ch] << " "; */
+        kls[ch] = (D_1_2 + D_2_1) / 2;
     }
     // quadratic mean of 3 channels
-    double kl = sqrt((kls[0]*kls[0] + kls[1]*kls[1] + kls[2]*kls[2])/3);
-    /* cout << ".......... " << kl << endl; */
-    return kl;
+    return sqrt((kls[0] * kls[0] + kls[1] * kls[1] + kls[2] * kls[2]) / 3);
+}
+
+double compare_hist(ImgSeq *images,
+                    const vector<Point3i> &points_1,
+                    const vector<Point3i> &points_2) {
+    ColorHist hist_1, hist_2;
+    hist_add_points(images, points_1, hist_1);
+    hist_add_points(images, points_2, hist_2);
+    return hist_distance(hist_1, hist_2);
+}
+
+vector<RadialDir> cv_best_radial_dirs(ImgSeq *images, Point3i point,
+                                      int start_deg, int end_deg, int step,
+                                      double pos_T, double neg_T,
+                                      int min_changed, size_t k) {
+    vector<RadialDir> dirs;
+    Point3i bound = images->bound();
+    if (step < 1 || out_of_canvas(point, bound))
+        return dirs;
+    Mat img = images->frame(point.z);
+    for (int ang = start_deg; ang <= end_deg; ang++) {
+        if (ang % step != 0)
+            continue;
+        // same direction vectors as angle2dir_2d/2
+        double rad = ang * CV_PI / 180;
+        Point3i dir(round(10e6 * cos(rad)), round(10e6 * sin(rad)), 0);
+        vector<Point3i> pts = get_line_points(point, dir, bound);
+        // 1-d brightness gradients along the line, the first one is 0
+        long n_pos = 0, n_neg = 0;
+        int prev = -1;
+        for (auto it = pts.begin(); it != pts.end(); ++it) {
+            int l = img.ptr<uchar>(it->y)[it->x * img.channels()];
+            int grad = prev < 0 ? 0 : l - prev;
+            if (grad >= pos_T)
+                n_pos++;
+            if (grad < neg_T)
+                n_neg++;
+            prev = l;
+        }
+        RadialDir rd;
+        rd.ratio = n_pos + n_neg > min_changed ?
+            n_pos / (n_pos + n_neg + 10e-10) : -1;
+        rd.dir = dir;
+        dirs.push_back(rd);
+    }
+    // rank as keysort/2 + reverse/2
+    stable_sort(dirs.begin(), dirs.end(),
+                [](const RadialDir &a, const RadialDir &b) {
+                    return a.ratio < b.ratio;
+                });
+    reverse(dirs.begin(), dirs.end());
+    if (dirs.size() > k)
+        dirs.resize(k);
+    return dirs;
 }
 
 #endif
@@ -0,0 +1,173 @@
+/* On-disk image sequence cache
+ *     Preprocessed frames are stored raw after a fixed header, so that
+ *     a sequence can be memory mapped instead of decoded again.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _SEQFILE_HPP
+#define _SEQFILE_HPP
+
+#include "imgseq.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <iostream> // for standard I/O
+#include <string>   // for strings
+
+using namespace std;
+using namespace cv;
+
+#define SEQFILE_MAGIC "LVIMGSEQ"
+#define SEQFILE_VERSION 1
+#define SEQFILE_ALIGN 4096 // frame data starts at a page boundary
+
+/********** declaration ***********/
+
+/* File header (native byte order), followed by padding up to data_offset
+ *     and then D frames of H rows of W * channels elements each.
+ */
+struct SeqFileHeader {
+    char magic[8];          // SEQFILE_MAGIC
+    uint32_t version;       // SEQFILE_VERSION
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;         // number of frames
+    uint32_t channels;
+    int32_t type;           // OpenCV element type, e.g. CV_8UC3
+    int32_t color_code;     // cvtColor code applied to frames, -1: unknown
+    int32_t blur_size;      // medianBlur kernel size, 0: none
+    uint64_t frame_bytes;   // size of one frame
+    uint64_t data_offset;   // offset of the first frame
+};
+
+/* Image sequence mapped from a cache file, the volume is the mapping
+ *     (MAP_PRIVATE: unmodified pages are shared with other processes
+ *     through the page cache, drawing on a frame copies its pages)
+ */
+class MmapSeq : public Volume {
+public:
+    MmapSeq(void *addr, size_t length, const SeqFileHeader &header);
+    ~MmapSeq();
+private:
+    void *addr;
+    size_t length;
+};
+
+// save an image sequence into a cache file
+bool cv_save_imgseq(ImgSeq *seq, string path);
+/* whether a header describes a sequence that the samplers can read
+ *     (8-bit frames of 1 or 3 channels) and whose frames fit into a file
+ *     of file_size bytes
+ */
+bool seqfile_header_valid(const SeqFileHeader &header, uint64_t file_size);
+// map a cache file as an image sequence, NULL if failed
+MmapSeq *cv_mmap_imgseq(string path);
+
+/*********** implementation ************/
+MmapSeq::MmapSeq(void *addr, size_t length, const SeqFileHeader &header)
+    : Volume(header.width, header.height, header.depth, header.type,
+             (uchar *) addr + header.data_offset,
+             header.frame_bytes / header.height, header.frame_bytes),
+      addr(addr), length(length) {
+    color_code = header.color_code;
+    blur_size = header.blur_size;
+}
+
+MmapSeq::~MmapSeq() {
+    frames.clear();
+    munmap(addr, length);
+}
+
+bool cv_save_imgseq(ImgSeq *seq, string path) {
+    SeqFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEQFILE_MAGIC, sizeof(header.magic));
+    header.version = SEQFILE_VERSION;
+    header.width = seq->width();
+    header.height = seq->height();
+    header.depth = seq->depth();
+    Mat first = seq->depth() > 0 ? seq->frame(0) : Mat();
+    header.type = first.empty() ? CV_8UC3 : first.type();
+    header.channels = CV_MAT_CN(header.type);
+    header.color_code = seq->color_code;
+    header.blur_size = seq->blur_size;
+    size_t row_bytes = first.empty() ? 0 : first.cols * first.elemSize();
+    header.frame_bytes = row_bytes * header.height;
+    header.data_offset = SEQFILE_ALIGN;
+
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+        cerr << "Cannot open " << path << " for writing!" << endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    // pad to the page boundary
+    vector<char> pad(header.data_offset - sizeof(header), 0);
+    ok = ok && fwrite(pad.data(), 1, pad.size(), fp) == pad.size();
+    for (int z = 0; ok && z < seq->depth(); z++) {
+        Mat img = seq->frame(z);
+        // rows may be padded (e.g. ROI), write them one by one
+        for (int r = 0; ok && r < img.rows; r++)
+            ok = fwrite(img.ptr(r), 1, row_bytes, fp) == row_bytes;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+        cerr << "Writing " << path << " failed!" << endl;
+    return ok;
+}
+
+bool seqfile_header_valid(const SeqFileHeader &header, uint64_t file_size) {
+    if (memcmp(header.magic, SEQFILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SEQFILE_VERSION ||
+        header.width == 0 || header.height == 0)
+        return false;
+    if ((header.type != CV_8UC1 && header.type != CV_8UC3) ||
+        header.channels != (uint32_t) CV_MAT_CN(header.type))
+        return false;
+    // frames are stored without row padding, no product overflows 64 bits
+    if (header.frame_bytes != (uint64_t) header.width *
+        CV_ELEM_SIZE(header.type) * header.height)
+        return false;
+    if (header.data_offset < sizeof(header) || header.data_offset > file_size)
+        return false;
+    return header.depth == 0 ||
+        header.frame_bytes <= (file_size - header.data_offset) / header.depth;
+}
+
+MmapSeq *cv_mmap_imgseq(string path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Cannot open " << path << "!" << endl;
+        return NULL;
+    }
+    struct stat st;
+    SeqFileHeader header;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+        !seqfile_header_valid(header, st.st_size)) {
+        cerr << path << " is not a valid image sequence file!" << endl;
+        close(fd);
+        return NULL;
+    }
+    // writable private mapping, so frames can be drawn on
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file referenced
+    if (addr == MAP_FAILED) {
+        cerr << "Mapping " << path << " failed!" << endl;
+        return NULL;
+    }
+    return new MmapSeq(addr, st.st_size, header);
+}
+
+#endif
@@ -0,0 +1,142 @@
+/* Ellipsoid stencils of local areas
+ *     The voxels in the ellipsoid of a radius are the same for every
+ *     point, so their offsets are computed once and cached.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _STENCIL_HPP
+#define _STENCIL_HPP
+
+#include "imgseq.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// cached stencils, the cache is cleared when it grows larger
+#define STENCIL_CACHE_SIZE 64
+
+/********** declaration **********/
+
+/* a voxel of a stencil relative to its centre
+ * @offset: byte offset in the frame, dy * row_step + dx * elem_size
+ */
+struct StencilPt {
+    int dx, dy, dz;
+    long offset;
+};
+
+/* voxels in the ellipsoid ((X - P1)/W)^2 + ((Y - P2)/H)^2 + ((Z - P3)/D)^2
+ *     <= 1, for frames with row_step bytes per row and elem bytes per pixel
+ * @pts: voxels ordered by dz
+ * @frame_start: pts[frame_start[k]] ... pts[frame_start[k + 1] - 1] are the
+ *     voxels of frame dz = k - D
+ */
+struct Stencil {
+    int rx, ry, rz;
+    size_t row_step, elem;
+    vector<StencilPt> pts;
+    vector<size_t> frame_start;
+
+    Stencil(int rx, int ry, int rz, size_t row_step, size_t elem);
+};
+
+/* get (cached) stencil of radius for frames of the layout of img */
+shared_ptr<const Stencil> get_stencil(Scalar radius, const Mat &img);
+
+/* apply func(const uchar *pixel) to the pixels in the ellipsoid of radius
+ *     around point, voxels outside the sequence are skipped
+ */
+template <class Func>
+void stencil_apply(ImgSeq *images, Point3i point, Scalar radius, Func func);
+
+/*********** implementation ************/
+Stencil::Stencil(int rx, int ry, int rz, size_t row_step, size_t elem)
+    : rx(rx), ry(ry), rz(rz), row_step(row_step), elem(elem) {
+    for (int dz = -rz; dz <= rz; dz++) {
+        frame_start.push_back(pts.size());
+        double p3 = rz > 0 ? ((double) dz / rz) * ((double) dz / rz) : 0;
+        for (int dy = -ry; dy <= ry; dy++) {
+            double p2 = ry > 0 ? ((double) dy / ry) * ((double) dy / ry) : 0;
+            for (int dx = -rx; dx <= rx; dx++) {
+                double p1 = rx > 0 ?
+                    ((double) dx / rx) * ((double) dx / rx) : 0;
+                if (p1 + p2 + p3 <= 1.0) {
+                    StencilPt pt = {dx, dy, dz,
+                                    (long) (dy * (long) row_step +
+                                            dx * (long) elem)};
+                    pts.push_back(pt);
+                }
+            }
+        }
+    }
+    frame_start.push_back(pts.size());
+}
+
+shared_ptr<const Stencil> get_stencil(Scalar radius, const Mat &img) {
+    typedef tuple<int, int, int, size_t, size_t> Key;
+    static map<Key, shared_ptr<const Stencil> > cache;
+    static mutex mtx;
+
+    int rx = max((int) radius[0], 0);
+    int ry = max((int) radius[1], 0);
+    int rz = max((int) radius[2], 0);
+    Key key(rx, ry, rz, img.step[0], img.elemSize());
+    lock_guard<mutex> lock(mtx);
+    auto it = cache.find(key);
+    if (it != cache.end())
+        return it->second;
+    if (cache.size() >= STENCIL_CACHE_SIZE)
+        cache.clear(); // stencils in use are kept alive by their holders
+    shared_ptr<const Stencil> st =
+        make_shared<Stencil>(rx, ry, rz, img.step[0], img.elemSize());
+    cache[key] = st;
+    return st;
+}
+
+template <class Func>
+void stencil_apply(ImgSeq *images, Point3i point, Scalar radius, Func func) {
+    int w = images->width();
+    int h = images->height();
+    int d = images->depth();
+    int x = point.x;
+    int y = point.y;
+    int z = point.z;
+    shared_ptr<const Stencil> st;
+    int rx = max((int) radius[0], 0);
+    int ry = max((int) radius[1], 0);
+    int rz = max((int) radius[2], 0);
+    // whether no voxel of the stencil leaves the frame
+    bool inside = x - rx >= 0 && x + rx < w && y - ry >= 0 && y + ry < h;
+    for (int dz = max(-rz, -z); dz <= rz && z + dz < d; dz++) {
+        Mat img = images->frame(z + dz);
+        // frames of a sequence normally share one layout
+        if (!st || img.step[0] != st->row_step || img.elemSize() != st->elem)
+            st = get_stencil(radius, img);
+        const uchar *centre = img.data + (long) y * img.step[0]
+            + (long) x * img.elemSize();
+        size_t end = st->frame_start[dz + rz + 1];
+        if (inside) {
+            for (size_t k = st->frame_start[dz + rz]; k < end; k++)
+                func(centre + st->pts[k].offset);
+        } else {
+            for (size_t k = st->frame_start[dz + rz]; k < end; k++) {
+                const StencilPt &p = st->pts[k];
+                int px = x + p.dx, py = y + p.dy;
+                if (px >= 0 && px < w && py >= 0 && py < h)
+                    func(centre + p.offset);
+            }
+        }
+    }
+}
+
+#endif
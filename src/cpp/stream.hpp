@@ -0,0 +1,164 @@
+/* Point streams
+ *     Points of lines, segments and ellipses generated one by one in the
+ *     order of get_line_points, get_line_seg_points and get_ellipse_points,
+ *     so searches stopping at the first hits do not build the whole list.
+ * ================================
+ * Version: 2.0
+ * Author: Wang-Zhou Dai <dai.wzero@gmail.com>
+ */
+
+#ifndef _STREAM_HPP
+#define _STREAM_HPP
+
+#include "sampler.hpp"
+#include "contour.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <memory>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+/********** declaration **********/
+
+/* a finite sequence of points, consumed by next() */
+class PointStream {
+public:
+    virtual ~PointStream() {}
+    // whether all points have been consumed
+    virtual bool done() = 0;
+    // the next point, only if !done()
+    virtual Point3i next() = 0;
+    /* append at most n next points to pts
+     * @return: number of appended points
+     */
+    size_t take(size_t n, vector<Point3i> &pts);
+};
+
+/* steps k0, k0 + step, ..., k1 of a digital line (see digital_line),
+ *     step is 1 or -1
+ */
+struct DigitalRun {
+    Point3i from, delta, inc;
+    long long k, k1;
+    int step;
+};
+
+/* points of digital runs, one after another */
+class LineStream : public PointStream {
+public:
+    // points of get_line_points(point, direction, bound)
+    static LineStream *line(Point3i point, Point3i direction, Point3i bound);
+    // points of get_line_seg_points(start, end, bound)
+    static LineStream *segment(Point3i start, Point3i end, Point3i bound);
+    bool done();
+    Point3i next();
+private:
+    vector<DigitalRun> runs;
+    size_t cur = 0;
+};
+
+/* points of get_ellipse_points(centre, param, bound) */
+class EllipseStream : public PointStream {
+public:
+    EllipseStream(Point3i centre, Scalar param, Point3i bound);
+    bool done();
+    Point3i next();
+private:
+    Point3i centre, bound;
+    shared_ptr<const vector<Point> > contour;
+    size_t cur = 0;
+};
+
+/*********** implementation ************/
+size_t PointStream::take(size_t n, vector<Point3i> &pts) {
+    size_t i = 0;
+    for (; i < n && !done(); i++)
+        pts.push_back(next());
+    return i;
+}
+
+LineStream *LineStream::line(Point3i point, Point3i direction,
+                             Point3i bound) {
+    LineStream *s = new LineStream();
+    if (direction.x == 0 && direction.y == 0 && direction.z == 0)
+        return s;
+    Point3i inc(direction.x > 0 ? 1 : -1,
+                direction.y > 0 ? 1 : -1,
+                direction.z > 0 ? 1 : -1);
+    // the half against the direction from its far end back to the point
+    long long k0 = 1, k1 = LLONG_MAX;
+    if (clip_digital_line(point, direction, -inc, bound, k0, k1) &&
+        k0 == 1) {
+        DigitalRun back = {point, direction, -inc, k1, k0, -1};
+        s->runs.push_back(back);
+    }
+    // the point itself, even if it is outside (as get_line_points)
+    DigitalRun self = {point, direction, inc, 0, 0, 1};
+    s->runs.push_back(self);
+    k0 = 1;
+    k1 = LLONG_MAX;
+    if (clip_digital_line(point, direction, inc, bound, k0, k1) &&
+        k0 == 1) {
+        DigitalRun forth = {point, direction, inc, k0, k1, 1};
+        s->runs.push_back(forth);
+    }
+    return s;
+}
+
+LineStream *LineStream::segment(Point3i start, Point3i end, Point3i bound) {
+    LineStream *s = new LineStream();
+    if (start == end)
+        return s;
+    Point3i delta = end - start;
+    Point3i inc(delta.x > 0 ? 1 : -1,
+                delta.y > 0 ? 1 : -1,
+                delta.z > 0 ? 1 : -1);
+    long long k0 = 0;
+    long long k1 = max(abs(delta.x), max(abs(delta.y), abs(delta.z)));
+    if (clip_digital_line(start, delta, inc, bound, k0, k1)) {
+        DigitalRun run = {start, delta, inc, k0, k1, 1};
+        s->runs.push_back(run);
+    }
+    return s;
+}
+
+bool LineStream::done() {
+    return cur >= runs.size();
+}
+
+Point3i LineStream::next() {
+    DigitalRun &run = runs[cur];
+    Point3i pt = digital_line_point(run.from, run.delta, run.inc, run.k);
+    if (run.k == run.k1)
+        cur++;
+    else
+        run.k += run.step;
+    return pt;
+}
+
+EllipseStream::EllipseStream(Point3i centre, Scalar param, Point3i bound)
+    : centre(centre), bound(bound), contour(get_ellipse_contour(param)) {
+    if (centre.z < 0 || centre.z >= bound.z)
+        cur = contour->size();
+}
+
+bool EllipseStream::done() {
+    // skip the contour points outside of the canvas
+    for (; cur < contour->size(); cur++) {
+        int x = centre.x + (*contour)[cur].x;
+        int y = centre.y + (*contour)[cur].y;
+        if (x >= 0 && x < bound.x && y >= 0 && y < bound.y)
+            return false;
+    }
+    return true;
+}
+
+Point3i EllipseStream::next() {
+    const Point &off = (*contour)[cur++];
+    return Point3i(centre.x + off.x, centre.y + off.y, centre.z);
+}
+
+#endif
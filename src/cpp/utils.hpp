@@ -7,6 +7,8 @@
 #ifndef _UTILS_HPP
 #define _UTILS_HPP
 
+#include "args.hpp"
+
 #include <opencv2/core/core.hpp> // opencv library
 #include <SWI-cpp.h>
 #include <SWI-Prolog.h>
@@ -34,9 +36,9 @@ template <typename T>
 std::vector<T> &operator+=(std::vector<T> &A, const std::vector<T> &B);
 
 /* list2vec
- * translate a PlTerm (list) into vector
- * @Type: c-type of terms in the list (int, long, double, wchar*, char*),
- *   CANNOT handle string
+ * translate a PlTerm (list) into vector (see term2vec in args.hpp), raise
+ *   type_error if it is not a list of size numbers
+ * @Type: c-type of terms in the list (int, long, double)
  * @PlTerm: input term
  * @size: number of elements in list, -1 means all elements
  */
@@ -54,18 +56,20 @@ PlTerm vecvec2list(vector<vector<Type>> vec, int size_outer = -1,
 /* Return an empty list */
 PlTerm empty_list();
 
-/* transformation between 3D-scalar vector and prolog list */
+/* transformation between 3D-scalar vector and prolog list, size < 0 means
+ * all elements, otherwise the first size elements are read */
 template <class Type>
 vector<Scalar> scalar_list2vec(PlTerm term, int size = -1);
 template <class Type>
 PlTerm scalar_vec2list(vector<Scalar> list, int size = -1);
 
 /* transformation between vector of point coordinates and prolog list
- * @term: prolog term of list, [[x1, y1, z1], [x2, y2, z2], ...]
- * @list: vector of scalar, each scalar is a point coordinate
+ * @term: prolog term of list, [[x1, y1, z1], [x2, y2, z2], ...], anything
+ *     else raises type_error
+ * @list: vector of points (packed integer coordinates)
  */
-vector<Scalar> point_list2vec(PlTerm term);
-PlTerm point_vec2list(vector<Scalar> list);
+vector<Point3i> point_list2vec(PlTerm term);
+PlTerm point_vec2list(const vector<Point3i> &list);
 
 /* Assert and retract a fact (PlCompoud as a PlTerm) in Prolog Engine */
 void pl_assert(string pred, PlTerm args);
@@ -83,29 +87,7 @@ Type *element_ptr_in_vector(const vector<Type> *vec, int idx) {
 
 template <class Type>
 vector<Type> list2vec(PlTerm term, int size) {
-    static_assert((is_same<Type, int>::value)
-                  || (is_same<Type, long>::value)
-                  || (is_same<Type, double>::value)
-                  || (is_same<Type, wchar_t*>::value)
-                  || (is_same<Type, char*>::value),
-                  "Wrong template type for list2vec!");
-    vector<Type> re;
-    try {
-        PlTail tail(term);
-        PlTerm e;
-        if (size == -1) {
-            while(tail.next(e))
-                re.push_back((Type) e);
-        } else {
-            for (int i = 0; i < size; i++) {
-                tail.next(e);
-                re.push_back((Type) e);
-            }
-        }
-        return re;
-    } catch (...) {
-        return re;
-    }
+    return term2vec<Type>(term, size);
 }
 template <class Type>
 PlTerm vec2list(vector<Type> list, int size) {
@@ -138,32 +120,18 @@ PlTerm vec2list(vector<Type> list, int size) {
 
 template <class Type>
 vector<vector<Type>> list2vecvec(PlTerm term, int size_outer, int size_inner) {
-    static_assert((is_same<Type, int>::value)
-                  || (is_same<Type, long>::value)
-                  || (is_same<Type, double>::value)
-                  || (is_same<Type, wchar_t*>::value)
-                  || (is_same<Type, char*>::value),
-                  "Wrong template type for list2vec!");
-    assert(term.type() != PL_VARIABLE);
-
-    vector<vector<Type>> re;
-    try {
-        PlTail tail(term);
-        PlTerm e;
-        if (size_outer == -1) {
-            while(tail.next(e)) {
-                vector<Type> p = list2vec<Type>(e, size_inner);
-                re.push_back(p);
-            }
-        } else {
-            for (int i = 0; i < size_outer; i++) {
-                tail.next(e);
-                vector<Type> p = list2vec<Type>(e, size_inner);
-                re.push_back(p);
-            }
-        }
-    } catch (...) {
-        cerr << "Parsing list error!" << endl;
+    size_t len;
+    if (PL_skip_list(term.ref, 0, &len) != PL_LIST ||
+        (size_outer >= 0 && len < (size_t) size_outer))
+        throw PlTypeError("list", term);
+    if (size_outer >= 0)
+        len = size_outer;
+    vector<vector<Type>> re(len);
+    term_t list = PL_copy_term_ref(term.ref);
+    term_t elem = PL_new_term_ref();
+    for (size_t i = 0; i < len; i++) {
+        PL_get_list(list, elem, list);
+        re[i] = term2vec<Type>(PlTerm(elem), size_inner);
     }
     return re;
 }
@@ -247,47 +215,40 @@ vector<Scalar> scalar_list2vec(PlTerm term, int size) {
                   || (is_same<Type, long>::value)
                   || (is_same<Type, double>::value),
                   "Wrong template type for list2vec!");
-    vector<Scalar> vec;
+    vector<Scalar> vec = term2scalar_vec(term);
+    if (size >= 0 && (size_t) size < vec.size())
+        vec.resize(size);
+    if (!is_same<Type, double>::value) // integer coordinates
+        for (auto it = vec.begin(); it != vec.end(); ++it)
+            for (int dim = 0; dim < 3; dim++)
+                (*it)[dim] = (Type) (*it)[dim];
+    return vec;
+}
+
+PlTerm point_vec2list(const vector<Point3i> &list) {
+    term_t term_ref = PL_new_term_ref();
+    PlTerm term(term_ref);
+    PlTail term_list(term);
     try {
-        PlTail term_list(term);
-        PlTerm point_term;
-        if (size < 0) {
-            while (term_list.next(point_term)) {
-                PlTail coord_list(point_term);
-                PlTerm coord_term;
-                Scalar pt(-1, -1, -1);
-                for (int dim = 0; dim < 3; dim++) {
-                    coord_list.next(coord_term);
-                    pt[dim] = (Type) coord_term;
-                }
-                vec.push_back(pt);
-            }
-        } else {
-            for (int i = 0; i < size; i++) {
-                if (!term_list.next(point_term))
-                    break;
-                PlTail coord_list(point_term);
-                PlTerm coord_term;
-                Scalar pt(-1, -1, -1);
-                for (int dim = 0; dim < 3; dim++) {
-                    coord_list.next(coord_term);
-                    pt[dim] = (Type) coord_term;
-                }
-                vec.push_back(pt);                
-            }
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            term_t point_ref = PL_new_term_ref();
+            PlTerm point_term(point_ref);
+            PlTail coord_list(point_term);
+            coord_list.append((long) it->x);
+            coord_list.append((long) it->y);
+            coord_list.append((long) it->z);
+            coord_list.close();
+            term_list.append(point_term);
         }
+        term_list.close();
     } catch (...) {
-        cerr << "[point_list2vec] Recieving coordinates from prolog list error !" << endl;
+        cerr << "[point_vec2list] Create prolog list failed!" << endl;
     }
-    return vec;
-}
-
-PlTerm point_vec2list(vector<Scalar> list) {
-    return scalar_vec2list<long>(list);
+    return term;
 }
 
-vector<Scalar> point_list2vec(PlTerm term) {
-    return scalar_list2vec<int>(term);
+vector<Point3i> point_list2vec(PlTerm term) {
+    return term2point_vec(term);
 }
 
 template <typename T>
@@ -10,12 +10,13 @@
 % draw line (not line segment, no boundary)
 %============================================
 draw_line_2d(Image, Point, Dir, Color):-
-    size_2d(Image, W, H),
-    line_points(Point, Dir, [W, H, 10e300], Pts),
+    img_size(Image, W, H),
+    Point = [_, _, Z], D is Z + 1, % any frame of the point
+    line_points(Point, Dir, [W, H, D], Pts),
     nth1(1, Pts, St), last(Pts, Lst), % get start and end points
     draw_line_seg_2d(Image, St, Lst, Color). % use opencv line drawing
     
 draw_line(Imgseq, Point, Dir, Color):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Point, Dir, [W, H, D], Pts),
     draw_points(Imgseq, Pts, Color). % draw points
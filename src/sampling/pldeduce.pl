@@ -8,12 +8,11 @@
 
 /* line sampling to deduce light source */
 sample_light_source_dir(Imgseq, Frame, Pt, Dir):-
-    size_2d(Imgseq, W, H),
+    seq_size(Imgseq, W, H, _),
     random(0, W, X), random(0, H, Y), % random position
     radial_lines_2d([X, Y, Frame], 0, 360, 2, Lines), % sample radial lines
-    sample_lines_L_grads(Imgseq, Lines, Pts, Gs),
     % TODO statistics of positve and negative gradients
-    grad_prop(Pts, Gs, Prp),
+    lines_grad_prop(Imgseq, Lines, Prp),
     max_list_idx(Prp, Max_idx),
     nth1(Max_idx, Lines, Max_line),
     Max_line = [Pt, Dir].
@@ -31,5 +30,24 @@ grad_prop([Pts | Points], [Grd | Grads], [P | Props]):-
 grad_prop([_ | Points], [_ | Grads], [P | Props]):-
     P is -1,
     grad_prop(Points, Grads, Props).
+
+/* proportion of gradients (Pos/Neg) of the brightness on lines, as
+ * grad_prop/3 on sampled lines, but the lines are sampled in one call and
+ * the samples stay in packed buffers */
+lines_grad_prop(Imgseq, Lines, Props):-
+    lines_color(Imgseq, Lines, _, Colors, [buffers(true)]),
+    colors_grad_prop(Colors, Props).
+
+colors_grad_prop([], []):-
+    !.
+colors_grad_prop([Colors | Cs], [P | Props]):-
+    buffer_channel(Colors, 1, L),
+    buffer_diff(L, Grd),
+    buffer_count(Grd, geq(2), NPos), % grad+ (>=2)
+    buffer_count(Grd, less(-1), NNeg), % grad- (< -1)
+    (NPos + NNeg > 20 -> % no trivial directions
+         P is NPos/(NNeg + 10e-10);
+     P is -1),
+    colors_grad_prop(Cs, Props).
     
 
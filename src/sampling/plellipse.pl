@@ -8,16 +8,18 @@
 :- ensure_loaded(['../sampling/plsampling.pl']).
 
 /* Sample one ellipse in image
- * @Img: input image
+ * @Img: input image sequence, the ellipse is sampled on its first frame
  * @Elps: parameter of the sampled ellipse, Elps = [Center, [A, B, ALPHA]],
  *     Center is the center of the ellipse
  *     A, B are axis length
  *     ALPHA: tilt angle
+ *   RANSAC on the edges around a random position, fails if there is none
  */
 sample_ellipse(Img, Elps):-
-    % TODO:
-    Elps = [Center, [A, B, ALPHA]],
-    fail.
+    seq_size(Img, W, H, _),
+    random(0, W, X), random(0, H, Y), % random position
+    random(0, 65536, Seed),
+    ransac_ellipses(Img, radial([X, Y, 0]), [seed(Seed), top(1)], [_-Elps]).
 
 /* Abuductive definition of an object
  */
@@ -34,14 +36,11 @@ object(X):-
  * @P_THRESH:
  */
 ellipse(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, P_THRESH):-
-    ellipse(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, P_THRESH, _, _).
+    ellipse_support(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, _, R),
+    (R >= P_THRESH; true), !.
 ellipse(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, P_THRESH, Pos, PTS):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     ellipse_points([X, Y, F], [A, B, ALPHA], [W, H, D], PTS),
-    pts_scharr(Imgseq, PTS, VARS),
-    write(VARS), nl,
-    items_key_geq_T(PTS, VARS, VAR_THRESH, Pos),
-    length(Pos, N_Pos), length(PTS, Total),
-    R is N_Pos / Total,
-    write(R), nl,
+    ellipse_support(Imgseq, [[X, Y, F], [A, B, ALPHA]], VAR_THRESH, _, R,
+                    Pos),
     (R >= P_THRESH; true), !.
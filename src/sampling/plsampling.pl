@@ -24,28 +24,28 @@ angle2dir_2d(Angle, Dir):-
 % sample_line_var(+Imgseq, +Start, +Direct, -Points, -Vars)
 % sample a line to get its points and cooresponding variance
 sample_line_var(Imgseq, Start, Direct, Points, Vars):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Start, Direct, [W, H, D], Points),
     pts_var(Imgseq, Points, Vars).
 
 % sample_line_seg_var(+Imgseq, +Start, +End, -Points, -Vars)
 % sample a line segment to get its points and cooresponding variance
 sample_line_seg_var(Imgseq, Start, End, Points, Vars):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_seg_points(Start, End, [W, H, D], Points),
     pts_var(Imgseq, Points, Vars).
 
 % sample_line_scharr(+Imgseq, +Start, +Direct, -Points, -Grads)
 % sample a line to get its points and cooresponding scharr gradients
 sample_line_scharr(Imgseq, Start, Direct, Points, Grads):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Start, Direct, [W, H, D], Points),
     pts_scharr(Imgseq, Points, Grads).
 
 % sample_line_seg_scharr(+Imgseq, +Start, +End, -Points, -Grads)
 % sample a line segment to get its points and cooresponding variance
 sample_line_seg_scharr(Imgseq, Start, End, Points, Grads):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_seg_points(Start, End, [W, H, D], Points),
     pts_scharr(Imgseq, Points, Grads).
 
@@ -55,21 +55,21 @@ sample_line_seg_scharr(Imgseq, Start, End, Points, Grads):-
 % sample_line_color(+Imgseq, +Start, +Direct, -Points, -Colors)
 % sample a line to get its points and cooresponding color
 sample_line_color(Imgseq, Start, Direct, Points, Colors):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Start, Direct, [W, H, D], Points),
     pts_color(Imgseq, Points, Colors).
 
 % sample_line_seg_color(+Imgseq, +Start, +End, -Points, -Colors)
 % sample a line segment to get its points and cooresponding color
 sample_line_seg_color(Imgseq, Start, End, Points, Colors):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Start, End, [W, H, D], Points),
     pts_color(Imgseq, Points, Colors).
 
 % sample_line_color_L(+Imgseq, +Start, +Direct, -Points, -Lchannel)
 % sample a line to get its points and cooresponding brightness
 sample_line_color_L(Imgseq, Start, Direct, Points, Lchannel):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Start, Direct, [W, H, D], Points),
     pts_color(Imgseq, Points, Colors),
     column(1, Colors, Lchannel). % nth1 starts with index 1
@@ -77,7 +77,7 @@ sample_line_color_L(Imgseq, Start, Direct, Points, Lchannel):-
 % sample_line_seg_color_L(+Imgseq, +Start, +End, -Points, -Lchannel)
 % sample a line segment to get its points and cooresponding brightness
 sample_line_seg_color_L(Imgseq, Start, End, Points, Lchannel):-
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Start, End, [W, H, D], Points),
     pts_color(Imgseq, Points, Colors),
     column(1, Colors, Lchannel).
@@ -91,13 +91,18 @@ sample_line_L_grad(Imgseq, Pt, Dir, Points, Grads):-
     sample_line_color(Imgseq, Pt, Dir, Points, Colors),
     grad_l(Colors, Grads).
 
-sample_lines_L_grads(_, [], [], []):-
+% sample_lines_L_grads(+Imgseq, +Lines, -Points, -Grads)
+% sample lines [[Pt, Dir], ...] in one call (lines_color/4) and get their
+% brightness gradients
+sample_lines_L_grads(Imgseq, Lines, Points, Grads):-
+    lines_color(Imgseq, Lines, Points, Colors),
+    grads_l(Colors, Grads).
+
+grads_l([], []):-
     !.
-sample_lines_L_grads(Imgseq, [L | Lines], [Pts | Points], [Grds | Grads]):-
-    L = [Pt, Dir],
-    sample_line_color(Imgseq, Pt, Dir, Pts, Colors),
-    grad_l(Colors, Grds),
-    sample_lines_L_grads(Imgseq, Lines, Points, Grads).
+grads_l([Colors | Cs], [Grd | Grds]):-
+    grad_l(Colors, Grd),
+    grads_l(Cs, Grds).
 
 
 % sample_line_seg_L_grad(+Imgseq, +Start, +End, -Points, -Grads)
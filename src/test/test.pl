@@ -31,7 +31,7 @@ test_load_imgseq(B):-
 test_load_v(A):-
     test_write_start('load video'),
     load_video('../../data/Protist.mp4', A),
-    size_3d(A, X, Y, Z),
+    video_size(A, X, Y, Z),
     write('W x H x D: '),
     write(X), write(' x '), write(Y), write(' x '), write(Z), nl,
     test_write_done.
@@ -42,6 +42,88 @@ test_v2s(A, B):-
     video2imgseq(A, B),
     test_write_done.
 
+% test video to image sequence with N preprocessing threads
+test_v2s_threads(A, B, N):-
+    test_write_start('video to image sequence (multithreaded)'),
+    video2imgseq(A, B, [threads(N)]),
+    seq_size(B, W, H, D),
+    write('W x H x D: '),
+    write(W), write(' x '), write(H), write(' x '), write(D), nl,
+    test_write_done.
+
+% test loading a part of video: every 2nd frame of [10, 30), cropped and
+% downscaled by 2
+test_v2s_part(A, B):-
+    test_write_start('video to image sequence (range, crop, downscale)'),
+    video2imgseq(A, B, [start(10), end(30), step(2),
+                        crop(100, 50, 320, 240), downscale(2)]),
+    seq_size(B, W, H, D),
+    W =:= 160, H =:= 120, D =:= 10,
+    write('W x H x D: '),
+    write(W), write(' x '), write(H), write(' x '), write(D), nl,
+    test_write_done.
+
+% test video to lazily decoded image sequence (at most 16 frames in memory)
+test_v2s_lazy(A, B):-
+    test_write_start('video to lazy image sequence'),
+    video2imgseq_lazy(A, 16, B),
+    seq_size(B, W, H, D),
+    write('W x H x D: '),
+    write(W), write(' x '), write(H), write(' x '), write(D), nl,
+    Z is D - 1,
+    sample_point_color(B, [100, 100, Z], C),
+    write('color of last frame: '), write(C), nl,
+    test_write_done.
+
+% test saving image sequence to a cache file and mapping it back
+test_save_mmap_s(B, Path, C):-
+    test_write_start('save and mmap image sequence'),
+    save_imgseq(B, Path),
+    mmap_imgseq(Path, C),
+    seq_size(B, W, H, D),
+    seq_size(C, W, H, D),
+    sample_point_color(B, [100, 100, 0], Color),
+    sample_point_color(C, [100, 100, 0], Color),
+    write('color: '), write(Color), nl,
+    % a truncated file is rejected
+    atom_concat(Path, '.trunc', Trunc),
+    open(Path, read, In, [type(binary)]),
+    open(Trunc, write, Out, [type(binary)]),
+    copy_stream_data(In, Out, 5000),
+    close(In), close(Out),
+    \+ mmap_imgseq(Trunc, _),
+    delete_file(Trunc),
+    test_write_done.
+
+% test handles: frames keep released sequences alive, released handles
+% and handles of wrong type raise errors
+test_handles(B):-
+    test_write_start('typed handles'),
+    clone_seq(B, S),
+    seq_img(S, 0, IMG),
+    seq_img(S, 0, IMG), % same frame, same handle
+    release_imgseq(S),
+    clone_img(IMG, IMG2),
+    release_img(IMG2),
+    catch(sample_point_color(S, [100, 100, 0], _), E1, true),
+    write(E1), nl,
+    catch(sample_point_color(IMG, [100, 100, 0], _), E2, true),
+    write(E2), nl,
+    test_write_done.
+
+% test size queries of handles and the size_2d/size_3d compatibility layer
+test_sizes(B):-
+    test_write_start('handle sizes'),
+    seq_size(B, W, H, D),
+    size_3d(B, W, H, D),
+    seq_img(B, 0, IMG),
+    img_size(IMG, W, H),
+    size_2d(IMG, W, H),
+    \+ size_3d(IMG, _, _, _),
+    write('W x H x D: '),
+    write(W), write(' x '), write(H), write(' x '), write(D), nl,
+    test_write_done.
+
 % test release video
 test_rel_v(A):-
     test_write_start('release video.'),
@@ -104,7 +186,7 @@ test_draw_elps(IMGSEQ, [Center, [A, B, ALPHA]], COLOR):-
     test_write_start('draw ellipse'),
     seq_img(IMGSEQ, 0, IMG1),
     clone_img(IMG1, IMG2),
-    size_3d(IMGSEQ, W, H, D),
+    seq_size(IMGSEQ, W, H, D),
     ellipse_points(Center, [A, B, ALPHA], [W, H, D], PTS),
     draw_points_2d(IMG2, PTS, COLOR),
     showimg_win(IMG2, 'debug'),
@@ -116,7 +198,7 @@ test_fit_elps(IMGSEQ, Center, [A, B, ALPHA], COLOR):-
     test_write_start('fit ellipse'),
     seq_img(IMGSEQ, 0, IMG1),
     clone_img(IMG1, IMG2),
-    size_3d(IMGSEQ, W, H, D),
+    seq_size(IMGSEQ, W, H, D),
     ellipse_points(Center, [A, B, ALPHA], [W, H, D], PTS),
     index_select([1, 30, 50, 70, 90, 110, 130, 150, 170, 190], PTS, PTS2),
     %PTS2 = PTS,
@@ -155,6 +237,275 @@ test_sample_line_color(Imgseq, Pts, Color):-
     release_img(IMG2),    
     test_write_done.
 
+% box neighbourhoods from integral images: a single pixel box is the pixel
+% itself, drawing on the sequence updates the sums, boxes of points outside
+% of the sequence are empty
+test_pts_box(Imgseq):-
+    test_write_start('box neighbourhood sampling'),
+    line_points([100, 100, 0], [10, -7, 0], [200, 200, 1], Pts),
+    pts_color_loc(Imgseq, Pts, [0, 0, 0], ellipsoid, Cs),
+    pts_color_loc(Imgseq, Pts, [0, 0, 0], box, Cs),
+    pts_var_loc(Imgseq, Pts, [3, 3, 0], box, Vars),
+    print(Vars), nl,
+    seq_size(Imgseq, W, _, _), X is W + 10,
+    Out = [[-10, 5, 0], [X, 5, 0]],
+    pts_var_loc(Imgseq, Out, [3, 3, 0], box, [V1, V2]),
+    V1 =:= 0, V2 =:= 0,
+    clone_seq(Imgseq, Seq),
+    pts_color_loc(Seq, [[100, 100, 0]], [2, 2, 0], box, [C1]),
+    draw_points(Seq, [[100, 100, 0]], white),
+    pts_color_loc(Seq, [[100, 100, 0]], [2, 2, 0], box, [C2]),
+    C1 \= C2,
+    release_imgseq(Seq),
+    test_write_done.
+
+% cached Scharr gradients follow drawing on the sequence
+test_pts_scharr_draw(Imgseq):-
+    test_write_start('cached scharr gradients'),
+    clone_seq(Imgseq, Seq),
+    Pts = [[99, 100, 0], [100, 100, 0], [101, 100, 0]],
+    pts_scharr(Seq, Pts, G1),
+    draw_points(Seq, [[100, 100, 0]], white),
+    pts_scharr(Seq, Pts, G2),
+    G1 \= G2,
+    print(G1), nl, print(G2), nl,
+    release_imgseq(Seq),
+    test_write_done.
+
+% native best directions agree with sampling the best line in prolog
+test_best_dirs(Imgseq):-
+    test_write_start('best radial directions'),
+    best_dirs(Imgseq, [100, 100, 0], 30, Prp_dirs),
+    length(Prp_dirs, 6),
+    pairs_keys(Prp_dirs, Ratios),
+    msort(Ratios, Sorted), reverse(Sorted, Ratios),
+    Prp_dirs = [R-[Pt, Dir] | _],
+    sample_line_L_grad(Imgseq, Pt, Dir, _, Gs),
+    include([G]>>(G >= 2), Gs, Pos), length(Pos, NPos),
+    include([G]>>(G < -1), Gs, Neg), length(Neg, NNeg),
+    (NPos + NNeg > 20 -> abs(R - NPos/(NPos + NNeg + 10e-10)) < 1e-6;
+     R =:= -1),
+    print(Prp_dirs), nl,
+    test_write_done.
+
+% large point lists sampled in parallel give the serial results
+test_pts_threads(Imgseq):-
+    test_write_start('parallel point sampling'),
+    findall([X, Y, 0], (between(0, 99, X), between(0, 99, Y)), Pts),
+    sampler_threads(1),
+    pts_var(Imgseq, Pts, V1), pts_color(Imgseq, Pts, C1),
+    pts_scharr(Imgseq, Pts, G1),
+    sampler_threads(4),
+    pts_var(Imgseq, Pts, V2), pts_color(Imgseq, Pts, C2),
+    pts_scharr(Imgseq, Pts, G2),
+    sampler_threads(0), sampler_threads(N), N == 0,
+    V1 == V2, C1 == C2, G1 == G2,
+    test_write_done.
+
+% lines and segments are clipped to the canvas
+test_line_clip:-
+    test_write_start('line clipping'),
+    Bound = [100, 80, 1],
+    line_points([50, 40, 0], [10000000, 5773503, 0], Bound, Pts),
+    line_seg_points([-50, 40, 0], [150, 40, 0], Bound, Seg),
+    length(Seg, 100), Seg = [[0, 40, 0] | _], last(Seg, [99, 40, 0]),
+    line_seg_points([-10, -10, 0], [-1, 200, 0], Bound, []),
+    forall(member([X, Y, Z], Pts),
+           (X >= 0, X < 100, Y >= 0, Y < 80, Z =:= 0)),
+    print(Pts), nl,
+    test_write_done.
+
+% RANSAC ellipses are reproducible with a seed
+test_ransac_ellipse(Imgseq):-
+    test_write_start('RANSAC ellipse detection'),
+    Opts = [iterations(200), top(3), seed(42)],
+    ransac_ellipses(Imgseq, radial([351, 147, 0]), Opts, Elps),
+    sampler_threads(1),
+    ransac_ellipses(Imgseq, radial([351, 147, 0]), Opts, Elps1),
+    sampler_threads(0),
+    Elps == Elps1,
+    length(Elps, N), N =< 3,
+    forall(member(R-[[_, _, 0], [A, B, _]], Elps),
+           (R >= 0, R =< 1, A >= B, B >= 3)),
+    print(Elps), nl,
+    test_write_done.
+
+% fit many ellipses in one call, degenerate sets give []
+test_fit_elps_batch:-
+    test_write_start('batched ellipse fitting'),
+    ellipse_points([120, 80, 0], [40, 20, 30], [640, 480, 1], PTS),
+    index_select([1, 20, 40, 60, 80, 100, 120], PTS, PTS2),
+    Line = [[0, 0, 0], [1, 1, 0], [2, 2, 0], [3, 3, 0], [4, 4, 0]],
+    fit_elps(PTS2, Cen, Param),
+    fit_elps_batch([PTS2, Line, PTS2], Cens, Params),
+    Cens = [Cen, [], Cen], Params = [Param, [], Param],
+    \+ fit_elps(Line, _, _),
+    print(Cen-Param), nl,
+    test_write_done.
+
+% native ellipse support agrees with sampling the ellipse points
+test_ellipse_support(Imgseq):-
+    test_write_start('ellipse support'),
+    Elps = [[340, 143, 0], [35, 17, 100]],
+    seq_size(Imgseq, W, H, D),
+    ellipse_points([340, 143, 0], [35, 17, 100], [W, H, D], PTS),
+    pts_scharr(Imgseq, PTS, Grads),
+    items_key_geq_T(PTS, Grads, 2, Pos),
+    length(Pos, N_Pos), length(PTS, Total),
+    ellipse_support(Imgseq, Elps, 2, [N_Pos, Total], R),
+    ellipse_support(Imgseq, Elps, 2, _, R, Pos),
+    print(R), nl,
+    test_write_done.
+
+% ellipse contours are ordered, 8-connected and without duplicates
+test_ellipse_contour:-
+    test_write_start('ellipse contour'),
+    ellipse_points([100, 100, 0], [30, 20, 45], [640, 480, 1], PTS),
+    sort(PTS, Sorted), length(PTS, N), length(Sorted, N),
+    PTS = [First | _], last(PTS, Last),
+    forall((nextto([X1, Y1, _], [X2, Y2, _], PTS);
+            [[X1, Y1, _], [X2, Y2, _]] = [Last, First]),
+           (abs(X1 - X2) =< 1, abs(Y1 - Y2) =< 1)),
+    % clipped at the border
+    ellipse_points([0, 0, 0], [30, 20, 45], [640, 480, 1], Clipped),
+    forall(member([X, Y, 0], Clipped), (X >= 0, Y >= 0)),
+    print(N), nl,
+    test_write_done.
+
+% rectangles, spans and point lists of the same pixels have one histogram
+test_compare_hist_many(Imgseq):-
+    test_write_start('compare many histograms'),
+    findall([X, Y, 0], (between(50, 79, Y), between(100, 139, X)), Pts),
+    findall([Y, 100, 139], between(50, 79, Y), Spans),
+    Pts2 = [[335, 133, 0], [336, 134, 0], [337, 135, 0]],
+    compare_hist_many(Imgseq, rect([100, 50, 0], [40, 30]),
+                      [Pts, spans(0, Spans), Pts2], [D1, D2, D3]),
+    D1 =:= 0, D2 =:= 0,
+    compare_hist(Imgseq, Pts, Pts2, D), abs(D - D3) < 1e-9,
+    print(D3), nl,
+    test_write_done.
+
+% light sources voted by the rays of random points, reproducible by seed
+test_light_source_votes(Imgseq):-
+    test_write_start('light source voting'),
+    Opts = [points(30), top(3), seed(7)],
+    light_source_votes(Imgseq, 0, Opts, Srcs),
+    light_source_votes(Imgseq, 0, Opts, Srcs1),
+    Srcs == Srcs1,
+    length(Srcs, N), N =< 3,
+    forall(member(V-[_, _, F], Srcs), (V > 0, F =:= 0)),
+    print(Srcs), nl,
+    test_write_done.
+
+% repeated samplings are answered from the memo of the sequence
+test_sample_memo(Imgseq):-
+    test_write_start('memoized samplings'),
+    sampler_memo_clear(Imgseq),
+    best_radial_dirs(Imgseq, [100, 100, 0], [0, 359, 30], [2, -1, 20], 3, D1),
+    best_radial_dirs(Imgseq, [100, 100, 0], [0, 359, 30], [2, -1, 20], 3, D2),
+    D1 == D2,
+    sampler_memo(Imgseq, [1, 1, 1]),
+    sampler_memo_clear(Imgseq),
+    sampler_memo(Imgseq, [0, 0, 0]),
+    test_write_done.
+
+% points generated on backtracking are the points of the lists
+test_point_streams:-
+    test_write_start('point streams'),
+    Bound = [200, 150, 10],
+    line_points([50, 40, 0], [3, 1, 0], Bound, Pts),
+    findall(P, line_point([50, 40, 0], [3, 1, 0], Bound, P), Pts),
+    findall(B, line_points([50, 40, 0], [3, 1, 0], Bound, 16, B), Bs),
+    append(Bs, Pts),
+    once(line_seg_point([0, 0, 0], [20, 5, 0], Bound, [0, 0, 0])),
+    ellipse_points([100, 75, 2], [30, 20, 45], Bound, EPts),
+    findall(P, ellipse_point([100, 75, 2], [30, 20, 45], Bound, P), EPts),
+    test_write_done.
+
+% samplings on packed buffers agree with the samplings on lists
+test_packed_buffers(Imgseq):-
+    test_write_start('packed buffers'),
+    seq_size(Imgseq, W, H, D),
+    line_points([50, 40, 0], [3, 1, 0], [W, H, D], Pts),
+    line_buffer([50, 40, 0], [3, 1, 0], [W, H, D], PtsB),
+    buffer_list(PtsB, Pts),
+    pts_scharr(Imgseq, Pts, Grads),
+    pts_scharr(Imgseq, PtsB, GradsB),
+    buffer_list(GradsB, Grads),
+    length(Pts, N), buffer_size(PtsB, N),
+    items_key_geq_T(Pts, Grads, 5, Edges),
+    buffer_select(PtsB, GradsB, geq(5), EdgesB),
+    buffer_list(EdgesB, Edges),
+    length(Edges, NE), buffer_count(GradsB, geq(5), NE),
+    max_list(Grads, Max), buffer_argmax(GradsB, Idx, Max),
+    nth1(Idx, Grads, Max),
+    buffer_slice(PtsB, 2, 3, SliceB), buffer_list(SliceB, [P2, _, _]),
+    nth1(2, Pts, P2),
+    pts_color(Imgseq, PtsB, ColorsB), buffer_channel(ColorsB, 1, LB),
+    buffer_diff(LB, GB), buffer_size(GB, N),
+    release_buffer(PtsB),
+    test_write_done.
+
+% malformed arguments raise type errors instead of being read partially
+test_arg_errors(Imgseq):-
+    test_write_start('argument type errors'),
+    catch((sample_point_var(Imgseq, [10, 10], _), fail),
+          error(type_error(point, [10, 10]), _), true),
+    catch((pts_var(Imgseq, [[10, 10, 0], [10, a, 0]], _), fail),
+          error(type_error(point_list, _), _), true),
+    catch((line_points([0, 0, 0], [1, 1, 0], [10, 10, 1.5], _), fail),
+          error(type_error(point, _), _), true),
+    catch((fit_elps_batch(foo, _, _), fail),
+          error(type_error(list, foo), _), true),
+    catch((ellipse_support(Imgseq, [[100, 75, 0], [30, 20, 0], x], 5, _, _),
+           fail),
+          error(type_error(ellipse, _), _), true),
+    \+ fit_elps([], _, _),
+    sample_point_var(Imgseq, [10, 10, 0], V), number(V),
+    test_write_done.
+
+% batch samplings of lines agree with sampling the lines one by one
+test_batch_lines(Imgseq):-
+    test_write_start('batch line samplings'),
+    seq_size(Imgseq, W, H, D),
+    Lines = [[[50, 40, 0], [3, 1, 0]], [[120, 80, 1], [-1, 2, 0]]],
+    lines_color(Imgseq, Lines, [Pts1, Pts2], [Colors1, _]),
+    line_points([50, 40, 0], [3, 1, 0], [W, H, D], Pts1),
+    line_points([120, 80, 1], [-1, 2, 0], [W, H, D], Pts2),
+    pts_color(Imgseq, Pts1, Colors1),
+    lines_scharr(Imgseq, Lines, _, [_, Grads2], [parallel(false)]),
+    pts_scharr(Imgseq, Pts2, Grads2),
+    segs_var(Imgseq, [[[0, 0, 0], [20, 5, 0]]], [SPts], [Vars]),
+    line_seg_points([0, 0, 0], [20, 5, 0], [W, H, D], SPts),
+    pts_var(Imgseq, SPts, Vars),
+    lines_color(Imgseq, Lines, [PtsB | _], [ColorsB | _], [buffers(true)]),
+    buffer_list(PtsB, Pts1), buffer_list(ColorsB, Colors1),
+    test_write_done.
+
+% lines are followed to the borders however short their direction is, the
+% crossing point is always returned
+test_line_points_bound:-
+    test_write_start('line points to the borders'),
+    line_points([50, 40, 0], [3, 1, 0], [200, 100, 1], Pts),
+    Pts = [[0, _, 0] | _], last(Pts, [199, _, 0]),
+    memberchk([50, 40, 0], Pts),
+    line_points([-1, 40, 0], [1, 0, 0], [200, 100, 1], [[-1, 40, 0] | Rest]),
+    length(Rest, 200),
+    line_points([-50, 40, 0], [1, 0, 0], [200, 100, 1], [[-50, 40, 0]]),
+    test_write_done.
+
+% ellipsoid neighbourhoods clipped at the borders of the sequence
+test_pts_border(Imgseq):-
+    test_write_start('neighbourhood sampling at borders'),
+    seq_size(Imgseq, W, H, D),
+    X is W - 1, Y is H - 1, Z is D - 1,
+    Pts = [[0, 0, 0], [X, Y, Z], [X, 0, 0], [100, 100, Z]],
+    pts_var_loc(Imgseq, Pts, [5, 5, 2], ellipsoid, Vars),
+    pts_color_loc(Imgseq, Pts, [5, 5, 2], ellipsoid, Colors),
+    print(Vars), nl,
+    print(Colors), nl,
+    test_write_done.
+
 % sample a line and its color
 test_sample_line_color_L(Imgseq, Pts, L):-
     test_write_start('sample line color - brightness'),
@@ -345,7 +696,7 @@ test_scharr(Imgseq, Point):-
 test_line_scharr(Imgseq, Point, Dir, Thresh):-
     test_write_start("Schurr gradient calculator"),
     %sample_line_scharr(Imgseq, Point, Dir, Pts, Grads),
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_points(Point, Dir, [W, H, D], Pts),
     line_pts_scharr_geq_T(Imgseq, Point, Dir, Thresh, Pos),
     %items_key_geq_T(Pts, Grads, Thresh, Pos),
@@ -379,7 +730,7 @@ test_rand_sample_line_scharr(Imgseq, Re, N, Tmp):-
     random_between(-10, 10, XX), random_between(0, 20, YY), % YY > 0
     C = [X, Y, 0],
     Dir = [XX, YY, 0],
-    %size_3d(Imgseq, W, H, D),
+    %seq_size(Imgseq, W, H, D),
     %line_points(C, Dir, [W, H, D], Pts),
     line_pts_scharr_geq_T(Imgseq, C, Dir, 2, Pos),
     append(Tmp, Pos, Tmp1),
@@ -392,7 +743,7 @@ test_rand_sample_line_scharr(Imgseq, Re, N, Tmp):-
 
 test_compare_hist(Imgseq, Dist):-
     test_write_start("test compare histograms"),
-    size_3d(Imgseq, W, H, D),
+    seq_size(Imgseq, W, H, D),
     line_pts_scharr_geq_T(Imgseq, [335, 133, 0], [1, 1, 0], 2, Pos),
     Pos = [P1, P2, P3 | _],
     line_seg_points(P1, P2, [W, H, D], Pts1),